@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #pragma once
+
+ #include <udjat/defs.h>
+ #include <sqlite3.h>
+ #include <udjat/sqlite/database.h>
+ #include <memory>
+ #include <string>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Incremental I/O on a BLOB column.
+		class UDJAT_API Blob {
+		private:
+			std::shared_ptr<Database> database;
+			sqlite3_blob *blob = nullptr;
+
+		public:
+
+			/// @brief Chunk size for incremental read/write.
+			static constexpr size_t chunk = 65536;
+
+			/// @brief Open blob.
+			/// @param database The database.
+			/// @param table The table name.
+			/// @param column The blob column name.
+			/// @param rowid The row id.
+			/// @param write true to open for writing.
+			Blob(std::shared_ptr<Database> database, const char *table, const char *column, int64_t rowid, bool write = false);
+			~Blob();
+
+			/// @brief Get blob size.
+			size_t size();
+
+			/// @brief Read from blob (offset and length up to INT_MAX).
+			void read(void *buffer, size_t length, size_t offset);
+
+			/// @brief Write to blob (can't change the blob size, offset and length up to INT_MAX).
+			void write(const void *buffer, size_t length, size_t offset);
+
+			/// @brief Read whole blob, in chunks, to a string sized only once.
+			/// @details The whole blob is still held in memory, as when reading a text column.
+			void get(std::string &value);
+
+			/// @brief Write whole buffer, in chunks.
+			void set(const void *buffer, size_t length);
+
+		};
+
+	}
+
+ }
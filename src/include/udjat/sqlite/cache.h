@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+ #pragma once
+
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <thread>
+ #include <mutex>
+ #include <condition_variable>
+ #include <unordered_map>
+ #include <list>
+ #include <string>
+ #include <memory>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Persistent key/value cache, a bounded in memory LRU in front of a WITHOUT ROWID table.
+		/// @details Writes are kept in memory and stored by a background thread in batched transactions;
+		/// expired rows are removed by a periodic sweep using an index on the expiration time.
+		class UDJAT_API Cache {
+		public:
+
+			/// @brief Cache counters.
+			struct Counters {
+				size_t hits = 0;		///< @brief Values found in memory.
+				size_t loads = 0;		///< @brief Values loaded from the database.
+				size_t misses = 0;		///< @brief Values not found.
+				size_t writes = 0;		///< @brief Rows stored or removed by the writer.
+				size_t expired = 0;		///< @brief Rows removed by the sweep.
+			};
+
+		private:
+
+			std::shared_ptr<Database> database;
+
+			/// @brief Connection of the writer thread (the shared one for in memory databases).
+			std::shared_ptr<Database> connection;
+
+			struct {
+				std::string select;
+				std::string replace;
+				std::string erase;
+				std::string expire;
+			} sql;
+
+			/// @brief Cached value.
+			struct Entry {
+				std::string value;
+				time_t expires = 0;							///< @brief Expiration time (0 to never expire).
+				std::list<std::string>::iterator position;	///< @brief Position on the LRU list.
+			};
+
+			/// @brief Write not yet stored.
+			struct Write {
+				bool erase = false;
+				std::string value;
+				time_t expires = 0;
+			};
+
+			/// @brief Max number of values in memory.
+			size_t capacity;
+
+			/// @brief Milliseconds to coalesce writes before storing them.
+			unsigned int delay;
+
+			/// @brief Seconds between expiration sweeps.
+			time_t interval;
+
+			/// @brief Keys, most recently used first.
+			std::list<std::string> lru;
+
+			std::unordered_map<std::string,Entry> entries;
+
+			/// @brief Writes waiting for the writer thread.
+			std::unordered_map<std::string,Write> pending;
+
+			/// @brief Writes on the running transaction.
+			std::unordered_map<std::string,Write> inflight;
+
+			/// @brief Keys being loaded from the database.
+			struct Load {
+				size_t readers = 0;		///< @brief Number of get() loading the key.
+				size_t version = 0;		///< @brief Incremented by each put() or erase() of the key.
+			};
+
+			std::unordered_map<std::string,Load> loading;
+
+			Counters counters;
+
+			bool enabled = true;
+			bool requested = false;		///< @brief flush() is waiting.
+			size_t stores = 0;			///< @brief Number of store attempts.
+			mutable std::mutex guard;
+			std::condition_variable wakeup;
+			std::condition_variable idle;	///< @brief Signaled after each store.
+			std::thread thread;
+
+			/// @brief Prepared select, serialized by its own mutex so lookups don't block the cache.
+			struct {
+				std::mutex guard;
+				std::unique_ptr<Statement> stmt;
+			} reader;
+
+			/// @brief Insert value in memory (must be called with the cache locked).
+			void remember(const std::string &key, const std::string &value, time_t expires);
+
+			/// @brief Search memory and unsaved writes (must be called with the cache locked).
+			/// @return 1 if found, 0 if expired or erased, -1 if the database should be searched.
+			int lookup(const std::string &key, std::string &value);
+
+			/// @brief Invalidate running loads of the key (must be called with the cache locked).
+			void written(const std::string &key);
+
+			/// @brief Load value from the database.
+			bool load(const char *key, std::string &value, time_t &expires);
+
+			/// @brief Store pending writes in a single transaction (releases the lock while writing).
+			/// @details On failure the writes go back to 'pending', unless newer ones were made.
+			void store(std::unique_lock<std::mutex> &lock, std::unique_ptr<Statement> &replace, std::unique_ptr<Statement> &erase);
+
+			/// @brief Remove expired rows.
+			void sweep();
+
+		public:
+
+			/// @brief Open cache, creating the table and the expiration index.
+			/// @param database The database.
+			/// @param table The cache table name.
+			/// @param capacity Max number of values in memory.
+			/// @param delay Milliseconds to coalesce writes before storing them.
+			/// @param interval Seconds between expiration sweeps.
+			Cache(std::shared_ptr<Database> database, const char *table = "cache", size_t capacity = 1000, unsigned int delay = 1000, time_t interval = 60);
+
+			/// @brief Store pending writes and stop the writer thread.
+			~Cache();
+
+			/// @brief Get value.
+			/// @param key The key.
+			/// @param value String to receive the value.
+			/// @return false if the key was not found or expired.
+			bool get(const char *key, std::string &value);
+
+			/// @brief Set value.
+			/// @param key The key.
+			/// @param value The value.
+			/// @param ttl Seconds to keep the value (0 to never expire).
+			void put(const char *key, const char *value, time_t ttl = 0);
+
+			/// @brief Remove value.
+			void erase(const char *key);
+
+			/// @brief Store pending writes now, waits for one store attempt.
+			void flush();
+
+			/// @brief Get the number of values in memory.
+			size_t size() const;
+
+			/// @brief Get the cache counters.
+			Counters status() const;
+
+		};
+
+	}
+
+ }
@@ -22,31 +22,218 @@
  #include <udjat/defs.h>
  #include <sqlite3.h>
  #include <mutex>
+ #include <condition_variable>
+ #include <thread>
  #include <memory>
+ #include <string>
+ #include <unordered_map>
+ #include <cstdint>
+ #include <atomic>
 
  namespace Udjat {
 
+	class Report;
+
 	namespace SQLite {
 
 		class Statement;
+		class Transaction;
+		class Blob;
 
 		/// @brief SQLite database.
 		class UDJAT_API Database {
 		private:
 			friend class Statement;
+			friend class Transaction;
+			friend class Blob;
 
 			sqlite3 *db = NULL;
-			std::mutex guard;
+
+			/// @brief Connection lock, held by Transaction from BEGIN to COMMIT so other threads can't join it.
+			std::recursive_mutex guard;
+
+			/// @brief Milliseconds to wait for a lock held by another connection or process.
+			unsigned int timeout = 5000;
+
+			/// @brief Page cache size, in KiB (0 for the SQLite default).
+			size_t kib = 0;
+
+			/// @brief Hosts on backoff (host, until).
+			struct {
+				std::mutex guard;
+				std::unordered_map<std::string,time_t> hosts;
+			} backoffs;
+
+			/// @brief Statement execution statistics.
+			struct Statistics {
+				size_t calls = 0;
+				uint64_t time = 0;		///< @brief Total time (nanoseconds).
+				uint64_t max = 0;		///< @brief Slowest execution (nanoseconds).
+				uint64_t steps = 0;		///< @brief Virtual machine steps.
+				uint64_t scans = 0;		///< @brief Full scan steps.
+				uint64_t sorts = 0;		///< @brief Sort operations.
+			};
+
+			/// @brief Profiled statements, shared with the connections copied from this one.
+			struct Profile {
+				std::mutex guard;
+
+				/// @brief Statistics by SQL text, up to 'limit' entries.
+				std::unordered_map<std::string,Statistics> statements;
+
+				/// @brief Max number of distinct statements; after it, new ones are added to a single entry.
+				size_t limit = 256;
+			};
+
+			/// @brief Statement profiler.
+			struct {
+				std::mutex guard;
+				bool enabled = false;
+				std::atomic<uint64_t> threshold{0};		///< @brief Log statements slower than this (nanoseconds).
+
+				/// @brief The statistics, set before enabling the trace and not replaced after it.
+				std::shared_ptr<Profile> data{std::make_shared<Profile>()};
+			} profiler;
+
+			/// @brief Statements aborted by time budget or cancellation.
+			struct {
+				std::atomic<size_t> timeouts{0};
+				std::atomic<size_t> cancelled{0};
+			} aborted;
+
+			/// @brief Background maintenance thread.
+			struct {
+				std::mutex guard;
+				std::condition_variable wakeup;
+				std::thread thread;
+				bool enabled = false;
+				bool requested = false;	///< @brief Wake up before the timer (WAL size trigger).
+				time_t interval = 0;	///< @brief Seconds between timer wake ups.
+			} maintenance;
+
+			/// @brief In memory database, saved to 'filename' on checkpoints.
+			struct {
+				std::string filename;	///< @brief The database file (empty if not in memory).
+				time_t interval = 0;	///< @brief Seconds between checkpoints.
+				time_t saved = 0;		///< @brief Timestamp of the last checkpoint.
+				uint64_t duration = 0;	///< @brief Duration of the last checkpoint (milliseconds).
+				uint64_t max = 0;		///< @brief Slowest checkpoint (milliseconds).
+			} memory;
+
+			/// @brief Background WAL checkpointer (protected by maintenance.guard).
+			struct {
+				sqlite3 *connection = nullptr;	///< @brief Checkpointer connection, writers are not blocked by it.
+				time_t interval = 0;			///< @brief Seconds between passive checkpoints.
+				int limit = 1000;				///< @brief WAL size (pages) to wake the checkpointer.
+				int pages = 0;					///< @brief Current WAL size (pages).
+				int highwater = 0;				///< @brief Largest WAL size (pages).
+				size_t commits = 0;				///< @brief Number of commits.
+				size_t checkpointed = 0;		///< @brief Number of commits on last checkpoint.
+				uint64_t duration = 0;			///< @brief Duration of the last checkpoint (milliseconds).
+				uint64_t max = 0;				///< @brief Slowest checkpoint (milliseconds).
+			} checkpointer;
+
+			/// @brief Start the maintenance thread.
+			/// @param interval Seconds between timer wake ups.
+			void start(time_t interval);
+
+			/// @brief Stop the maintenance thread.
+			void stop();
+
+			/// @brief Save in memory database to its file.
+			void save();
+
+			/// @brief Run a WAL checkpoint on the checkpointer connection.
+			/// @param mode The SQLITE_CHECKPOINT_* mode.
+			void checkpoint(int mode);
+
+			/// @brief Called by SQLite after each commit on WAL mode.
+			static int commit(void *context, sqlite3 *db, const char *name, int pages);
+
+			static int trace(unsigned int type, void *context, void *p, void *x);
 
 			void check(int rc);
 
+			/// @brief Apply the busy timeout, cache size and profiler of this connection to another one.
+			void copy(Database &connection);
+
+			/// @brief Register module SQL functions.
+			void setup();
+
 		public:
 			Database(const char *dbname);
+
+			/// @brief Open an in memory database, loaded from and saved to a file.
+			/// @param dbname The database file.
+			/// @param checkpoint Seconds between saves to dbname (0 to save only on close).
+			Database(const char *dbname, time_t checkpoint);
+
 			~Database();
 
+			/// @brief Get the sqlite module database, to be shared with other modules.
+			/// @return The module database, nullptr if the sqlite module isn't loaded.
+			static std::shared_ptr<Database> getInstance();
+
+			/// @brief Set the shared database (called by the sqlite module).
+			static void setInstance(std::shared_ptr<Database> database);
+
+			/// @brief Open another connection to the database file, with the same settings.
+			/// @details Commits on it wake the WAL checkpointer of this one, it should be closed first.
+			/// @return The new connection, nullptr for in memory or temporary databases.
+			std::shared_ptr<Database> connect();
+
+			/// @brief Open another database with the same settings (mode, WAL, busy timeout, cache, profiler).
+			/// @param dbname The database file.
+			std::shared_ptr<Database> open(const char *dbname);
+
+			/// @brief Get the database file name (empty for temporary databases).
+			const char * name() const noexcept;
+
+			/// @brief Enable WAL mode with a background checkpointer.
+			/// @param interval Seconds between passive checkpoints; when idle the WAL is truncated.
+			/// @param pages WAL size, in pages, to start a checkpoint before the timer.
+			void wal(time_t interval, unsigned int pages = 1000);
+
+			/// @brief Set how long to wait when the database is locked by another connection or process.
+			/// @param milliseconds The busy timeout (0 to fail at once with 'database is locked').
+			void busy(unsigned int milliseconds);
+
+			/// @brief Save in memory database to its file or run a passive WAL checkpoint.
+			void checkpoint();
+
 			void exec(const char *sql);
 
-			sqlite3_stmt * prepare(const char *sql);
+			/// @brief Put host on backoff, the SQL function backoff(host) will return the remaining seconds.
+			/// @param host The host name.
+			/// @param seconds The backoff time (0 to clear it).
+			void backoff(const char *host, time_t seconds);
+
+			/// @brief Get remaining backoff time for host.
+			time_t backoff(const char *host);
+
+			/// @brief Set process wide heap limits (0 to keep the current value).
+			/// @param soft The soft heap limit, in bytes.
+			/// @param hard The hard heap limit, in bytes.
+			static void limits(int64_t soft, int64_t hard);
+
+			/// @brief Set the page cache size of this connection.
+			/// @param kib Max cache size, in KiB.
+			void cache(size_t kib);
+
+			/// @brief Free as much memory as possible from this connection.
+			void release();
+
+			/// @brief Get memory and cache counters.
+			void status(Report &report);
+
+			/// @brief Enable statement profiling.
+			/// @param threshold Log statements slower than this (milliseconds).
+			void profile(unsigned int threshold);
+
+			/// @brief Get profiler report.
+			/// @param report The report object to get the slowest statements.
+			/// @param limit Max number of statements on report.
+			void profile(Report &report, size_t limit = 20);
 
 		};
 
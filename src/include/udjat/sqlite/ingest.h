@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #pragma once
+
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <atomic>
+ #include <thread>
+ #include <mutex>
+ #include <condition_variable>
+ #include <functional>
+ #include <string>
+ #include <memory>
+ #include <chrono>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Multi-producer ingest buffer, inserts records on a single consumer thread.
+		class UDJAT_API Ingest {
+		public:
+
+			/// @brief Buffered record.
+			struct Record {
+				std::string sql;		///< @brief The insert statement.
+				std::string url;
+				std::string verb;
+				std::string payload;
+				time_t not_before = 0;	///< @brief Don't send before this time.
+			};
+
+			/// @brief Write one record using a prepared statement.
+			/// @param database The connection of the statement.
+			/// @return true if a row was stored (false for ignored duplicates).
+			using Writer = std::function<bool(std::shared_ptr<Database> database, Statement &stmt, const Record &record)>;
+
+			/// @brief Called after each commit with the number of stored rows.
+			using Complete = std::function<void(size_t stored)>;
+
+		private:
+
+			/// @brief Queue node, producers link them with an atomic exchange on 'head'.
+			struct Node {
+				std::atomic<Node *> next{nullptr};
+				Record record;
+			};
+
+			std::shared_ptr<Database> database;
+
+			/// @brief Connection owned by the consumer thread (the shared one for in memory databases).
+			std::shared_ptr<Database> connection;
+
+			std::atomic<Node *> head;	///< @brief Last pushed node (producers side).
+			Node *tail;					///< @brief Next node to consume (consumer side).
+			Node stub;
+
+			/// @brief Number of buffered records.
+			std::atomic<size_t> length{0};
+
+			/// @brief Max number of buffered records.
+			size_t limit;
+
+			/// @brief Max number of records on each insert transaction.
+			size_t batch;
+
+			Writer writer;
+
+			Complete complete;
+
+			std::atomic<bool> enabled{true};
+
+			/// @brief When stopping, store batches only until this time.
+			std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+			std::mutex guard;
+			std::condition_variable wakeup;
+			std::thread thread;
+
+			/// @brief Get next record (consumer side).
+			Node * pop();
+
+			/// @brief Store up to 'max' records, return the number of consumed records.
+			size_t flush(size_t max);
+
+			/// @brief Is the shutdown deadline reached?
+			inline bool expired() const noexcept {
+				return !enabled && std::chrono::steady_clock::now() >= deadline;
+			}
+
+		public:
+			Ingest(std::shared_ptr<Database> database, size_t limit, size_t batch, const Writer &writer, const Complete &complete);
+			~Ingest();
+
+			/// @brief Enqueue record.
+			/// @return false if the buffer is full (or stopped) and the caller should insert it directly.
+			bool push(Record &&record);
+
+			/// @brief Stop accepting records and store all the buffered ones.
+			void stop();
+
+			/// @brief Stop accepting records and store the buffered ones until the deadline.
+			/// @details Records are stored in batches, the deadline is checked between them;
+			/// the records left after it are discarded (and logged).
+			/// @return The number of discarded records.
+			size_t stop(const std::chrono::steady_clock::time_point &deadline);
+
+			/// @brief Get the number of buffered records.
+			inline size_t size() const noexcept {
+				return length.load();
+			}
+
+		};
+
+	}
+
+ }
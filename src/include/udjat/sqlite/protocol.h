@@ -21,11 +21,22 @@
 
  #include <udjat/defs.h>
  #include <udjat/tools/protocol.h>
+ #include <udjat/sqlite/ingest.h>
  #include <list>
  #include <mutex>
+ #include <string>
+ #include <memory>
+ #include <vector>
+ #include <atomic>
+ #include <chrono>
+ #include <condition_variable>
 
  namespace Udjat {
 
+	namespace HTTP {
+		class Client;
+	}
+
 	namespace SQLite {
 
 		class UDJAT_API Protocol : public Udjat::Protocol {
@@ -33,6 +44,26 @@
 
 			std::shared_ptr<Database> database;
 
+			/// @brief Queue shard, a database file with its own connection and insert buffer.
+			struct Shard {
+				std::shared_ptr<Database> database;
+				std::unique_ptr<Ingest> ingest;				///< @brief Buffer for asynchronous inserts (nullptr if disabled).
+				mutable std::atomic<int64_t> queued{-1};	///< @brief Number of queued requests, updated on insert/delete (-1 when unknown).
+
+				Shard(std::shared_ptr<Database> db) : database{db} {
+				}
+			};
+
+			/// @brief Queue shards, the first one is the module database.
+			std::vector<std::unique_ptr<Shard>> shards;
+
+			/// @brief Send a request to its destination, throws on failure (HTTP::Exception with the status code).
+			/// @details The default implementation uses the cached HTTP clients.
+			/// @param method The request verb (HTTP::Get or HTTP::Post).
+			/// @param url The request URL.
+			/// @param payload The request payload (POST only).
+			virtual void deliver(HTTP::Method method, const Udjat::URL &url, const std::string &payload);
+
 		private:
 			const char *ins = nullptr;
 			const char *del = nullptr;
@@ -40,26 +71,283 @@
 			const char *list = nullptr;
 			const char *pending = nullptr;
 
-			bool busy = false;
+			/// @brief Export and import of queued requests as newline-delimited JSON.
+			struct {
+				const char *sql = nullptr;		///< @brief Get requests after an id (args: LAST_ID, LIMIT; columns: ID, URL, VERB, PAYLOAD).
+				const char *filename = nullptr;	///< @brief File for the 'export/run' and 'import/run' reports.
+				std::mutex guard;				///< @brief Only one export or import at a time.
+			} ndjson;
+
+			/// @brief Deduplication counters, an insert ignored by the database ('ON CONFLICT DO NOTHING') is a duplicate.
+			struct {
+				mutable std::atomic<size_t> received{0};	///< @brief Requests checked for duplicates.
+				mutable std::atomic<size_t> duplicates{0};	///< @brief Requests ignored as duplicates.
+			} dedup;
+
+			/// @brief Time budget of each query kind, in milliseconds (0 for unlimited).
+			struct {
+				unsigned int select = 0;		///< @brief The select or claim query.
+				unsigned int pending = 0;
+				unsigned int report = 0;
+				unsigned int coalesce = 0;
+				unsigned int next = 0;
+			} timeouts;
+
+			/// @brief Cancels the running queue queries when the shutdown deadline is reached.
+			std::shared_ptr<Cancellation> cancellation{std::make_shared<Cancellation>()};
+
+			/// @brief Sender state.
+			struct {
+				std::mutex guard;
+				std::condition_variable idle;	///< @brief Signaled when a send completes.
+				bool busy = false;				///< @brief A request is being sent.
+				bool stopped = false;			///< @brief Shutting down, don't start new sends.
+			} sender;
 
 			std::mutex guard;
 
 			/// @brief Interval between URL send.
 			time_t send_delay = 1;
 
+			/// @brief Seconds to keep a host on backoff after a failure (see SQL function backoff(host)).
+			time_t backoff = 60;
+
+			/// @brief Lease based dequeue, allow more than one sender on the same queue.
+			struct {
+				const char *claim = nullptr;	///< @brief Claim one request (args: OWNER, SECONDS; columns: ID, URL, VERB, PAYLOAD).
+				const char *release = nullptr;	///< @brief Release a claimed request after a failure (args: ID, OWNER).
+				std::string owner;				///< @brief Owner id of this sender.
+				time_t time = 300;				///< @brief Lease time in seconds.
+			} lease;
+
+			/// @brief Scheduled delivery.
+			struct {
+				const char *next = nullptr;		///< @brief Get the earliest 'not before' time (columns: TIMESTAMP).
+				const char *defer = nullptr;	///< @brief Defer a failed request (args: NOT_BEFORE, ID).
+				time_t delay = 0;				///< @brief Delay for new requests, in seconds.
+				time_t retry = 300;				///< @brief Delay for failed requests, in seconds.
+			} schedule;
+
+			/// @brief Payloads stored as BLOBs, with incremental I/O.
+			struct {
+				const char *table = nullptr;	///< @brief The queue table (the request id must be its rowid).
+				const char *column = nullptr;	///< @brief The payload column.
+			} blob;
+
+			/// @brief How to join coalesced payloads.
+			enum Envelope : uint8_t {
+				None,			///< @brief Don't coalesce requests.
+				JsonArray,		///< @brief Send payloads as a JSON array.
+				Lines			///< @brief Send payloads as newline-delimited records.
+			};
+
+			/// @brief Coalescing of queued POSTs to the same URL.
+			struct {
+				const char *sql = nullptr;	///< @brief Get requests with the same URL and verb (args: URL, VERB; columns: ID, PAYLOAD).
+				Envelope envelope = None;
+				size_t count = 100;			///< @brief Max number of requests on a coalesced POST.
+				size_t bytes = 1048576;		///< @brief Max size of a coalesced POST.
+			} coalesce;
+
+			/// @brief How new requests are spread across shards.
+			enum Distribution : uint8_t {
+				Host,			///< @brief By hash of the destination host.
+				RoundRobin		///< @brief One shard after the other.
+			} distribution = Host;
+
+			/// @brief Next shard for round-robin inserts.
+			mutable std::atomic<size_t> cursor{0};
+
+			/// @brief First shard to check on the next send.
+			size_t next = 0;
+
+			/// @brief Get the shard for a new request.
+			Shard & shard(const char *url) const;
+
+			/// @brief Count pending requests on shard.
+			int64_t count(const Shard &shard) const;
+
+			/// @brief Set host backoff on all shards.
+			void suspend(const char *url, time_t seconds) noexcept;
+
+			/// @brief Outcome of a delivery attempt.
+			enum Outcome : uint8_t {
+				Success,		///< @brief Request was sent.
+				Retryable,		///< @brief Network or server failure, try again later.
+				Permanent		///< @brief Request will never be accepted (client error, unsupported verb).
+			};
+
+			/// @brief Classify a HTTP status code.
+			static Outcome outcome(unsigned int code) noexcept;
+
+			/// @brief Dead-letter handling of failed requests.
+			struct {
+				const char *fail = nullptr;		///< @brief Count a failed attempt (args: ID).
+				const char *sql = nullptr;		///< @brief Copy request to the dead-letter table (args: ID, REASON).
+				unsigned int attempts = 0;		///< @brief Max attempts before moving a request to dead-letter (0 to retry forever).
+			} deadletter;
+
+			/// @brief Count a failed attempt, move requests to dead-letter when permanent or out of attempts.
+			/// @param shard The requests shard.
+			/// @param ids The request ids.
+			/// @param attempts Number of previous attempts.
+			/// @param outcome The failure classification.
+			/// @param reason The failure message.
+			/// @return true if the requests were moved to the dead-letter table.
+			bool failed(Shard &shard, const std::vector<int64_t> &ids, unsigned int attempts, Outcome outcome, const char *reason) noexcept;
+
+			/// @brief Move requests to the dead-letter table, in the same transaction as the delete.
+			void bury(Shard &shard, const std::vector<int64_t> &ids, const char *reason);
+
+			/// @brief Join queued requests for the same URL and verb.
+			/// @param shard The requests shard.
+			/// @param url The request URL.
+			/// @param action The request verb.
+			/// @param ids The request ids, the first one already loaded.
+			/// @param payload The first request payload.
+			/// @return The coalesced payload.
+			std::string group(Shard &shard, const char *url, const char *action, std::vector<int64_t> &ids, const std::string &payload);
+
+			/// @brief Remove requests from queue.
+			void remove(Shard &shard, const std::vector<int64_t> &ids);
+
+			/// @brief Release leased requests after a failure.
+			void release(Shard &shard, const std::vector<int64_t> &ids) noexcept;
+
+			/// @brief Defer failed requests.
+			void defer(Shard &shard, const std::vector<int64_t> &ids) noexcept;
+
+			/// @brief Insert request using a prepared insert statement.
+			/// @param database The connection of the statement.
+			/// @return true if the request was stored, false if ignored as duplicate.
+			bool store(std::shared_ptr<Database> database, Statement &stmt, const Ingest::Record &record) const;
+
+			/// @brief Update queue size after committing new requests.
+			void enqueued(Shard &shard, size_t count) noexcept;
+
+			/// @brief Update queue size after removing requests.
+			void dequeued(Shard &shard, size_t count) noexcept;
+
+			/// @brief Check the query plan, warn on full scans and temporary b-trees.
+			/// @param name The query name (for messages).
+			/// @param sql The query to check.
+			/// @param autoindex If true, create the recommended index when possible.
+			/// @return true if the query plan has no problems.
+			bool explain(const char *name, const char *sql, bool autoindex);
+
 			std::list<Abstract::Agent *> listeners;
 
+			/// @brief Preallocated queue states, 'many' is replaced (under guard) when the queue size changes.
+			mutable struct {
+				std::mutex guard;
+				std::shared_ptr<Abstract::State> none;
+				std::shared_ptr<Abstract::State> empty;
+				std::shared_ptr<Abstract::State> one;
+				std::shared_ptr<Abstract::State> many;
+				int64_t value = -1;		///< @brief The queue size on the 'many' state summary.
+			} states;
+
+			/// @brief Cache of HTTP clients, grouped by endpoint.
+			/// @details HTTP::Client is bound to an URL, so a client is reused only for requests to the same URL;
+			/// whether the TCP/TLS connection is kept alive between calls depends on the HTTP backend.
+			class Connections {
+			private:
+
+				struct Entry {
+					std::string url;
+					std::shared_ptr<HTTP::Client> client;
+					time_t last = 0;		///< @brief Last time this client was used.
+					size_t requests = 0;	///< @brief Requests sent using this client.
+				};
+
+				struct Endpoint {
+					std::string name;		///< @brief scheme://host:port
+					std::list<Entry> entries;
+					size_t requests = 0;
+					size_t reused = 0;		///< @brief Requests sent with a cached client object.
+				};
+
+				std::mutex guard;
+				std::list<Endpoint> endpoints;
+
+			public:
+
+				/// @brief Max cached clients (one per URL) for each endpoint.
+				size_t max = 2;
+
+				/// @brief Seconds to keep an idle client.
+				time_t idle = 60;
+
+				/// @brief Get client for url, reusing a cached one when available.
+				std::shared_ptr<HTTP::Client> get(const char *url);
+
+				/// @brief Remove client from cache (after a failure).
+				void remove(const char *url);
+
+				/// @brief Release idle clients.
+				void cleanup();
+
+				/// @brief Get client reuse report.
+				void get(Report &report);
+
+			} connections;
+
 		public:
 			Protocol(std::shared_ptr<Database> db, const pugi::xml_node &node);
 			virtual ~Protocol();
 
+			/// @brief Stop the queue: no new sends, store buffered requests and wait for the active send.
+			/// @param deadline When the deadline is reached, interrupt the active send (the request stays queued).
+			/// @return true if the queue was stopped within the deadline.
+			bool stop(const std::chrono::steady_clock::time_point &deadline) noexcept;
+
 			/// @brief Send one queued URL.
 			/// @return true if the first URL was sent.
 			bool send() noexcept;
 
-			/// @brief Count pending requests.
+			/// @brief Send one queued URL.
+			/// @param bytes Receives the size of the sent payload.
+			/// @return true if the first URL was sent.
+			bool send(size_t &bytes) noexcept;
+
+			/// @brief Get the number of pending requests, without a query when it's known.
+			inline int64_t size() const {
+				int64_t total = 0;
+				for(auto &shard : shards) {
+					int64_t value = shard->queued.load();
+					total += (value < 0 ? count(*shard) : value);
+				}
+				return total;
+			}
+
+			/// @brief Export queued requests as newline-delimited JSON (id, url, verb, payload).
+			/// @param filename The output file.
+			/// @return The number of exported requests.
+			size_t dump(const char *filename);
+
+			/// @brief Import requests exported by dump(), inserted in large transactions.
+			/// @details The number of committed lines is kept on '<filename>.progress', a failed import
+			/// resumes after them and the file is removed when the import completes.
+			/// @param filename The input file.
+			/// @param batch Number of requests on each transaction.
+			/// @return The number of imported requests.
+			size_t load(const char *filename, size_t batch = 10000);
+
+			/// @brief Get the number of lines committed by an incomplete import of the file.
+			static size_t imported(const char *filename);
+
+			/// @brief Count pending requests on all shards (runs the 'pending' query).
 			int64_t count() const;
 
+			/// @brief Does the queue have scheduled requests?
+			inline bool scheduled() const noexcept {
+				return schedule.next && *schedule.next;
+			}
+
+			/// @brief Get the time of the earliest scheduled request.
+			/// @return Unix time of the next due request, 0 if there's none.
+			time_t due() const;
+
 			/// @brief Insert listener agent.
 			void insert(Abstract::Agent *listener);
 
@@ -77,6 +365,7 @@
 			bool get(const char *path, Report &report);
 
 			/// @brief Get State based on queue size.
+			/// @return One of the preallocated states, no query unless the queue size is unknown.
 			std::shared_ptr<Abstract::State> state() const;
 
 			std::shared_ptr<Protocol::Worker> WorkerFactory() const override;
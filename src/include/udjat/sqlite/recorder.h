@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #pragma once
+
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <mutex>
+ #include <thread>
+ #include <condition_variable>
+ #include <string>
+ #include <vector>
+ #include <memory>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Time-series recorder, stores agent values with minute/hour rollups.
+		class UDJAT_API Recorder {
+		private:
+
+			struct Sample {
+				std::string agent;
+				time_t timestamp;
+				double value;
+			};
+
+			std::shared_ptr<Database> database;
+
+			/// @brief Base table name, rollups are stored on '<table>_minute' and '<table>_hour'.
+			std::string table;
+
+			std::mutex guard;
+			std::condition_variable wakeup;
+			std::thread thread;
+			bool enabled = true;
+
+			/// @brief Buffered samples.
+			std::vector<Sample> samples;
+
+			/// @brief Downsample into a rollup table.
+			/// @param from The source table.
+			/// @param to The rollup table.
+			/// @param interval The rollup bucket size, in seconds.
+			/// @param raw true if the source table has raw samples.
+			void rollup(const std::string &from, const std::string &to, time_t interval, bool raw);
+
+			/// @brief Remove rows older than 'seconds' from table.
+			void expire(const std::string &name, time_t seconds);
+
+			/// @brief Flush buffered samples when reaching this size.
+			size_t batch = 100;
+
+			/// @brief Seconds between flushes of buffered samples.
+			time_t interval = 60;
+
+			/// @brief Seconds between rollups.
+			time_t downsample = 300;
+
+			/// @brief How many seconds to keep on each table.
+			struct {
+				time_t samples = 86400;
+				time_t minutes = 604800;
+				time_t hours = 31536000;
+			} retention;
+
+		public:
+			Recorder(std::shared_ptr<Database> database, const pugi::xml_node &node);
+			~Recorder();
+
+			/// @brief Buffer a sample.
+			void push(const char *agent, double value, time_t timestamp = 0);
+
+			/// @brief Store buffered samples.
+			void flush();
+
+			/// @brief Update rollup tables and remove expired rows.
+			void rollup();
+
+		};
+
+	}
+
+ }
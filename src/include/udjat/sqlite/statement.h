@@ -23,30 +23,264 @@
  #include <sqlite3.h>
  #include <udjat/sqlite/database.h>
  #include <string>
+ #include <string_view>
+ #include <tuple>
+ #include <utility>
+ #include <type_traits>
+ #include <iterator>
+ #include <atomic>
+ #include <chrono>
 
  namespace Udjat {
 
 	namespace SQLite {
 
+		/// @brief Cancellation token, cancel() aborts the running statements using it from any thread.
+		class UDJAT_API Cancellation {
+		private:
+			std::atomic<bool> flag{false};
+
+		public:
+			inline void cancel() noexcept {
+				flag = true;
+			}
+
+			inline bool cancelled() const noexcept {
+				return flag.load();
+			}
+		};
+
 		class UDJAT_API Statement {
+		public:
+
+			/// @brief Expected column affinity for typed rows.
+			enum Affinity : uint8_t {
+				Integer,
+				Real,
+				Text
+			};
+
 		private:
 			std::shared_ptr<Database> database;
 			sqlite3_stmt *stmt;
 
+			/// @brief Column types were checked against the typed row.
+			bool checked = false;
+
+			/// @brief Time budget of each step (0 for unlimited).
+			std::chrono::milliseconds budget{0};
+
+			/// @brief Deadline of the running step.
+			std::chrono::steady_clock::time_point deadline;
+
+			/// @brief Cancellation token (nullptr if not cancellable).
+			std::shared_ptr<Cancellation> token;
+
+			/// @brief Progress handler, aborts the step when over budget or cancelled.
+			static int progress(void *statement);
+
+			/// @brief Run one step enforcing budget and cancellation (must be called with the database locked).
+			int run();
+
+			/// @brief Check declared column type (must be called with the database locked).
+			void check(int column, Affinity affinity);
+
+			template<typename T>
+			static constexpr Affinity affinity() noexcept {
+				if constexpr (std::is_integral<T>::value) {
+					return Integer;
+				} else if constexpr (std::is_floating_point<T>::value) {
+					return Real;
+				} else {
+					return Text;
+				}
+			}
+
+			// Column extraction, must be called with the database locked.
+			static inline void column(sqlite3_stmt *stmt, int col, int64_t &value) noexcept {
+				value = sqlite3_column_int64(stmt,col);
+			}
+
+			static inline void column(sqlite3_stmt *stmt, int col, int &value) noexcept {
+				value = sqlite3_column_int(stmt,col);
+			}
+
+			static inline void column(sqlite3_stmt *stmt, int col, double &value) noexcept {
+				value = sqlite3_column_double(stmt,col);
+			}
+
+			/// @brief Get the length of a text column, without the trailing NUL stored by bind(int, const char *).
+			static inline size_t length(sqlite3_stmt *stmt, int col, const char *str) noexcept {
+				size_t bytes = (size_t) sqlite3_column_bytes(stmt,col);
+				if(bytes && !str[bytes-1]) {
+					bytes--;
+				}
+				return bytes;
+			}
+
+			static inline void column(sqlite3_stmt *stmt, int col, std::string &value) {
+				const char *str = (const char *) sqlite3_column_text(stmt,col);
+				if(str) {
+					value.assign(str,length(stmt,col,str));
+				} else {
+					value.clear();
+				}
+			}
+
+			/// @brief Get text column without copying it, valid until the next step() or reset().
+			static inline void column(sqlite3_stmt *stmt, int col, std::string_view &value) noexcept {
+				const char *str = (const char *) sqlite3_column_text(stmt,col);
+				if(str) {
+					value = std::string_view{str,length(stmt,col,str)};
+				} else {
+					value = std::string_view{};
+				}
+			}
+
+			template<typename Tuple, size_t... I>
+			void fetch(Tuple &values, std::index_sequence<I...>) {
+				if(!checked) {
+					(check(I,affinity<typename std::decay<decltype(std::get<I>(values))>::type>()), ...);
+					checked = true;
+				}
+				(column(stmt,I,std::get<I>(values)), ...);
+			}
+
 		public:
+
+			/// @brief Typed rows, for range-for iteration.
+			template<typename... T>
+			class Rows {
+			private:
+				Statement &statement;
+
+			public:
+				Rows(Statement &s) : statement{s} {
+				}
+
+				class iterator {
+				private:
+					Statement *statement;
+					std::tuple<T...> values;
+
+					void next() {
+						if(statement->step() == SQLITE_ROW) {
+							values = statement->row<T...>();
+						} else {
+							statement = nullptr;
+						}
+					}
+
+				public:
+					using iterator_category = std::input_iterator_tag;
+					using value_type = std::tuple<T...>;
+					using difference_type = std::ptrdiff_t;
+					using pointer = const value_type *;
+					using reference = const value_type &;
+
+					iterator(Statement *s) : statement{s} {
+						if(statement) {
+							next();
+						}
+					}
+
+					inline reference operator*() const noexcept {
+						return values;
+					}
+
+					inline iterator & operator++() {
+						next();
+						return *this;
+					}
+
+					inline bool operator==(const iterator &it) const noexcept {
+						return statement == it.statement;
+					}
+
+					inline bool operator!=(const iterator &it) const noexcept {
+						return statement != it.statement;
+					}
+
+				};
+
+				inline iterator begin() {
+					return iterator{&statement};
+				}
+
+				inline iterator end() {
+					return iterator{nullptr};
+				}
+
+			};
+
 			Statement(std::shared_ptr<Database> database, const char *sql);
 			~Statement();
 
 			void reset();
 			void exec();
 
+			/// @brief Execute insert statement.
+			/// @return The rowid of the inserted row, 0 if no row was inserted (conflict ignored).
+			int64_t insert();
+
 			int step();
 
+			/// @brief Execute update or delete statement.
+			/// @return The number of changed rows.
+			int update();
+
+			/// @brief Set the time budget of each step, a step over it throws.
+			/// @param milliseconds The time budget (0 for unlimited).
+			Statement & timeout(unsigned int milliseconds);
+
+			/// @brief Set the cancellation token, a step running after cancel() throws.
+			Statement & cancellable(std::shared_ptr<Cancellation> token);
+
+			/// @brief Get the number of SQL parameters.
+			int parameters();
+
+			/// @brief Get the index of a named parameter.
+			/// @param name The parameter name, with prefix (':key').
+			/// @return The parameter index, 0 if not found.
+			int parameter(const char *name);
+
+			/// @brief Get the number of result columns.
+			int columns();
+
 			void get(int column, int64_t &value);
 			void get(int column, std::string &value);
+			void get(int column, double &value);
+
+			/// @brief Get the current row as a typed tuple, with a single lock.
+			/// @details Column types are checked against the declared ones on the first call.
+			template<typename... T>
+			std::tuple<T...> row() {
+				std::tuple<T...> values;
+				std::lock_guard<std::recursive_mutex> lock(database->guard);
+				fetch(values,std::index_sequence_for<T...>{});
+				return values;
+			}
+
+			/// @brief Iterate over the remaining rows as typed tuples.
+			/// @code
+			/// for(auto [id,url] : stmt.rows<int64_t,std::string>()) {
+			/// }
+			/// @endcode
+			template<typename... T>
+			inline Rows<T...> rows() {
+				return Rows<T...>{*this};
+			}
 
 			Statement & bind(int column, const char *value);
+
+			/// @brief Bind text without the trailing NUL stored by bind(int, const char *).
+			/// @details For tables compared with SQL literals ('agent = ...'); the queue tables keep the NUL.
+			Statement & bind(int column, const std::string_view &value);
 			Statement & bind(int column, const int64_t value);
+			Statement & bind(int column, const double value);
+
+			/// @brief Bind a zero-filled blob, to be written with SQLite::Blob.
+			Statement & zeroblob(int column, size_t length);
 
 			/// @brief Bind multiple columns.
 			Statement & bind(const char *arg,...) UDJAT_GNUC_NULL_TERMINATED;
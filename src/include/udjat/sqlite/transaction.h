@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #pragma once
+
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <memory>
+ #include <mutex>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Database transaction, rolled back if not committed.
+		/// @details The connection is shared, it stays locked to the calling thread until commit or rollback.
+		class UDJAT_API Transaction {
+		private:
+			std::shared_ptr<Database> database;
+			std::unique_lock<std::recursive_mutex> lock;
+			bool active = false;
+
+		public:
+			Transaction(std::shared_ptr<Database> database);
+			~Transaction();
+
+			/// @brief Commit changes.
+			void commit();
+
+			/// @brief Discard changes.
+			void rollback();
+
+		};
+
+	}
+
+ }
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/blob.h>
+ #include <algorithm>
+ #include <climits>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Blob::Blob(std::shared_ptr<Database> db, const char *table, const char *column, int64_t rowid, bool write) : database(db) {
+
+		if(!database->db) {
+			throw runtime_error("Database is not available");
+		}
+
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(sqlite3_blob_open(
+			database->db,
+			"main",
+			table,
+			column,
+			rowid,
+			(write ? 1 : 0),
+			&blob
+		));
+
+	}
+
+	SQLite::Blob::~Blob() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		sqlite3_blob_close(blob);
+	}
+
+	size_t SQLite::Blob::size() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		return (size_t) sqlite3_blob_bytes(blob);
+	}
+
+	/// @brief Incremental I/O uses int offsets, reject ranges above INT_MAX instead of truncating them.
+	static void check_range(size_t length, size_t offset) {
+		if(length > (size_t) INT_MAX || offset > (size_t) INT_MAX - length) {
+			throw runtime_error("BLOB range is larger than 2GiB");
+		}
+	}
+
+	void SQLite::Blob::read(void *buffer, size_t length, size_t offset) {
+		check_range(length,offset);
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(sqlite3_blob_read(blob,buffer,(int) length,(int) offset));
+	}
+
+	void SQLite::Blob::write(const void *buffer, size_t length, size_t offset) {
+		check_range(length,offset);
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(sqlite3_blob_write(blob,buffer,(int) length,(int) offset));
+	}
+
+	void SQLite::Blob::get(std::string &value) {
+
+		size_t length = size();
+		value.resize(length);
+
+		for(size_t offset = 0; offset < length; offset += chunk) {
+			read(&value[offset],std::min(chunk,length-offset),offset);
+		}
+
+	}
+
+	void SQLite::Blob::set(const void *buffer, size_t length) {
+
+		const uint8_t *ptr = (const uint8_t *) buffer;
+		for(size_t offset = 0; offset < length; offset += chunk) {
+			write(ptr+offset,std::min(chunk,length-offset),offset);
+		}
+
+	}
+
+ }
@@ -0,0 +1,442 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <udjat/sqlite/cache.h>
+ #include <iostream>
+ #include <chrono>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Max rows removed by each sweep statement.
+	static const int64_t sweep_limit = 1000;
+
+	SQLite::Cache::Cache(std::shared_ptr<Database> db, const char *table, size_t c, unsigned int d, time_t i)
+		: database{db}, capacity{c ? c : 1}, delay{d}, interval{i} {
+
+		// Clustered on the key, no rowid; the partial index keeps the sweep off never-expiring rows.
+		database->exec(
+			(
+				string{"create table if not exists "} + table
+					+ " (key text not null primary key, value text, expires integer not null default 0) without rowid;"
+				"create index if not exists " + table + "_expires on " + table + " (expires) where expires > 0;"
+			).c_str()
+		);
+
+		sql.select = string{"select value,expires from "} + table + " where key=?1 and (expires=0 or expires>?2)";
+		sql.replace = string{"insert or replace into "} + table + " (key,value,expires) values (?1,?2,?3)";
+		sql.erase = string{"delete from "} + table + " where key=?1";
+		sql.expire =
+			string{"delete from "} + table + " where key in (select key from " + table
+				+ " where expires > 0 and expires <= ?1 limit ?2)";
+
+		reader.stmt.reset(new Statement(database,sql.select.c_str()));
+
+		// Batches on the shared connection would hold it until commit.
+		connection = database->connect();
+		if(!connection) {
+			connection = database;
+		}
+
+		thread = std::thread([this](){
+
+			std::unique_ptr<Statement> replace, erase;
+			time_t next = time(0) + interval;
+
+			unique_lock<mutex> lock(guard);
+			while(enabled || !pending.empty()) {
+
+				if(enabled && !requested) {
+					// Coalesce writes, wakes up earlier when flushing or over capacity.
+					wakeup.wait_for(lock,chrono::milliseconds(delay ? delay : 1));
+				}
+
+				if(!pending.empty()) {
+					store(lock,replace,erase);
+				}
+
+				requested = false;
+				idle.notify_all();
+
+				if(interval && time(0) >= next) {
+					lock.unlock();
+					sweep();
+					lock.lock();
+					next = time(0) + interval;
+				}
+
+			}
+
+		});
+
+	}
+
+	SQLite::Cache::~Cache() {
+
+		{
+			lock_guard<mutex> lock(guard);
+			enabled = false;
+		}
+		wakeup.notify_all();
+
+		if(thread.joinable()) {
+			thread.join();
+		}
+
+		lock_guard<mutex> lock(reader.guard);
+		reader.stmt.reset();
+
+	}
+
+	void SQLite::Cache::remember(const std::string &key, const std::string &value, time_t expires) {
+
+		auto entry = entries.find(key);
+		if(entry != entries.end()) {
+			lru.splice(lru.begin(),lru,entry->second.position);
+			entry->second.value = value;
+			entry->second.expires = expires;
+			return;
+		}
+
+		lru.push_front(key);
+		Entry &created = entries[key];
+		created.value = value;
+		created.expires = expires;
+		created.position = lru.begin();
+
+		// Evict the least recently used, unsaved writes are kept on 'pending'.
+		while(entries.size() > capacity) {
+			entries.erase(lru.back());
+			lru.pop_back();
+		}
+
+	}
+
+	void SQLite::Cache::written(const std::string &key) {
+		auto entry = loading.find(key);
+		if(entry != loading.end()) {
+			entry->second.version++;
+		}
+	}
+
+	int SQLite::Cache::lookup(const std::string &key, std::string &value) {
+
+		time_t now = time(0);
+
+		auto entry = entries.find(key);
+		if(entry != entries.end()) {
+
+			if(!entry->second.expires || entry->second.expires > now) {
+				lru.splice(lru.begin(),lru,entry->second.position);
+				value = entry->second.value;
+				return 1;
+			}
+
+			lru.erase(entry->second.position);
+			entries.erase(entry);
+			return 0;
+
+		}
+
+		// Evicted before being stored.
+		for(auto writes : { &pending, &inflight }) {
+
+			auto write = writes->find(key);
+			if(write == writes->end()) {
+				continue;
+			}
+
+			if(write->second.erase || (write->second.expires && write->second.expires <= now)) {
+				return 0;
+			}
+
+			value = write->second.value;
+			remember(key,value,write->second.expires);
+			return 1;
+
+		}
+
+		return -1;
+
+	}
+
+	bool SQLite::Cache::load(const char *key, std::string &value, time_t &expires) {
+
+		lock_guard<mutex> lock(reader.guard);
+
+		Statement &stmt = *reader.stmt;
+		stmt.bind(1,key);
+		stmt.bind(2,(int64_t) time(0));
+
+		bool found = (stmt.step() == SQLITE_ROW);
+		if(found) {
+			auto [text, timestamp] = stmt.row<std::string,int64_t>();
+			value = std::move(text);
+			expires = (time_t) timestamp;
+		}
+
+		stmt.reset();
+		return found;
+
+	}
+
+	bool SQLite::Cache::get(const char *key, std::string &value) {
+
+		unique_lock<mutex> lock(guard);
+
+		for(;;) {
+
+			int rc = lookup(key,value);
+			if(rc >= 0) {
+				(rc ? counters.hits : counters.misses)++;
+				return rc;
+			}
+
+			// Not in memory, search the database without blocking the cache.
+			size_t version;
+			{
+				Load &entry = loading[key];
+				entry.readers++;
+				version = entry.version;
+			}
+
+			lock.unlock();
+
+			std::string loaded;
+			time_t expires = 0;
+			bool found = false;
+			try {
+				found = load(key,loaded,expires);
+			} catch(...) {
+				lock.lock();
+				auto entry = loading.find(key);
+				if(!--entry->second.readers) {
+					loading.erase(entry);
+				}
+				throw;
+			}
+
+			lock.lock();
+
+			bool written;
+			{
+				auto entry = loading.find(key);
+				written = (entry->second.version != version);
+				if(!--entry->second.readers) {
+					loading.erase(entry);
+				}
+			}
+
+			if(written) {
+				// A put() or erase() while loading, it can be already stored and evicted
+				// from memory; the loaded value is stale, search again.
+				continue;
+			}
+
+			rc = lookup(key,value);
+			if(rc >= 0) {
+				(rc ? counters.hits : counters.misses)++;
+				return rc;
+			}
+
+			if(!found) {
+				counters.misses++;
+				return false;
+			}
+
+			counters.loads++;
+			remember(key,loaded,expires);
+			value = std::move(loaded);
+			return true;
+
+		}
+
+	}
+
+	void SQLite::Cache::put(const char *key, const char *value, time_t ttl) {
+
+		time_t expires = (ttl ? time(0) + ttl : 0);
+
+		lock_guard<mutex> lock(guard);
+		written(key);
+		remember(key,value,expires);
+
+		Write &write = pending[key];
+		write.erase = false;
+		write.value = value;
+		write.expires = expires;
+
+		if(pending.size() >= capacity) {
+			wakeup.notify_one();
+		}
+
+	}
+
+	void SQLite::Cache::erase(const char *key) {
+
+		lock_guard<mutex> lock(guard);
+		written(key);
+
+		auto entry = entries.find(key);
+		if(entry != entries.end()) {
+			lru.erase(entry->second.position);
+			entries.erase(entry);
+		}
+
+		Write &write = pending[key];
+		write.erase = true;
+		write.value.clear();
+		write.expires = 0;
+
+	}
+
+	void SQLite::Cache::flush() {
+
+		unique_lock<mutex> lock(guard);
+		if(pending.empty() && inflight.empty()) {
+			return;
+		}
+
+		// The running store doesn't have the current pending writes, wait for the next one too.
+		size_t target = stores + (inflight.empty() ? 1 : 2);
+		while(enabled && stores < target) {
+			requested = true;
+			wakeup.notify_one();
+			idle.wait(lock);
+		}
+
+	}
+
+	void SQLite::Cache::store(std::unique_lock<std::mutex> &lock, std::unique_ptr<Statement> &replace, std::unique_ptr<Statement> &erase) {
+
+		// Writes stay visible on 'inflight' until committed.
+		inflight.swap(pending);
+		lock.unlock();
+
+		size_t count = 0;
+		bool failed = false;
+		try {
+
+			if(!replace) {
+				replace.reset(new Statement(connection,sql.replace.c_str()));
+				erase.reset(new Statement(connection,sql.erase.c_str()));
+			}
+
+			Transaction transaction{connection};
+
+			for(auto &[key, write] : inflight) {
+
+				if(write.erase) {
+					erase->bind(1,key.c_str());
+					erase->exec();
+					erase->reset();
+				} else {
+					replace->bind(1,key.c_str());
+					replace->bind(2,write.value.c_str());
+					replace->bind(3,(int64_t) write.expires);
+					replace->exec();
+					replace->reset();
+				}
+
+				count++;
+
+			}
+
+			transaction.commit();
+
+		} catch(const std::exception &e) {
+
+			cerr << "sqlite\tError storing " << inflight.size() << " cache value(s): " << e.what() << endl;
+			replace.reset();
+			erase.reset();
+			count = 0;
+			failed = true;
+
+		}
+
+		lock.lock();
+
+		if(failed) {
+			if(enabled) {
+				// Retry on the next store, newer writes to the same keys win.
+				for(auto &[key, write] : inflight) {
+					pending.emplace(key,std::move(write));
+				}
+			} else {
+				cerr << "sqlite\t" << inflight.size() << " cache value(s) lost on shutdown" << endl;
+			}
+		}
+
+		inflight.clear();
+		counters.writes += count;
+		stores++;
+
+	}
+
+	void SQLite::Cache::sweep() {
+
+		size_t count = 0;
+
+		try {
+
+			// Short deletes on the expiration index, other writers get the connection between them.
+			Statement stmt{connection,sql.expire.c_str()};
+			for(;;) {
+
+				stmt.bind(1,(int64_t) time(0));
+				stmt.bind(2,sweep_limit);
+				int changes = stmt.update();
+				stmt.reset();
+
+				count += changes;
+				if(changes < sweep_limit) {
+					break;
+				}
+
+			}
+
+		} catch(const std::exception &e) {
+
+			cerr << "sqlite\tError removing expired cache values: " << e.what() << endl;
+
+		}
+
+		lock_guard<mutex> lock(guard);
+		counters.expired += count;
+
+	}
+
+	size_t SQLite::Cache::size() const {
+		lock_guard<mutex> lock(guard);
+		return entries.size();
+	}
+
+	SQLite::Cache::Counters SQLite::Cache::status() const {
+		lock_guard<mutex> lock(guard);
+		return counters;
+	}
+
+ }
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/tools/logger.h>
+ #include <iostream>
+ #include <chrono>
+ #include <ctime>
+ #include <cstring>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	void SQLite::Database::start(time_t interval) {
+
+		if(!interval) {
+			return;
+		}
+
+		lock_guard<mutex> lock(maintenance.guard);
+
+		if(maintenance.interval == 0 || interval < maintenance.interval) {
+			maintenance.interval = interval;
+		}
+
+		if(maintenance.enabled) {
+			return;
+		}
+
+		maintenance.enabled = true;
+		maintenance.thread = std::thread([this](){
+
+			unique_lock<mutex> lock(maintenance.guard);
+			while(maintenance.enabled) {
+
+				maintenance.wakeup.wait_for(lock,chrono::seconds(maintenance.interval),[this]{
+					return !maintenance.enabled || maintenance.requested;
+				});
+
+				if(!maintenance.enabled) {
+					break;
+				}
+
+				// Requested by the WAL size trigger, or timer; no commits since the
+				// last checkpoint means the database is idle, reset the WAL then.
+				bool requested = maintenance.requested;
+				bool idle = (checkpointer.commits == checkpointer.checkpointed && checkpointer.pages);
+				maintenance.requested = false;
+
+				lock.unlock();
+				try {
+
+					if(!requested && !memory.filename.empty()) {
+						save();
+					}
+
+					if(checkpointer.connection) {
+						checkpoint(idle ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE);
+					}
+
+				} catch(const std::exception &e) {
+					cerr << "sqlite\t" << e.what() << endl;
+				}
+				lock.lock();
+
+			}
+
+		});
+
+	}
+
+	void SQLite::Database::stop() {
+
+		{
+			lock_guard<mutex> lock(maintenance.guard);
+			maintenance.enabled = false;
+		}
+		maintenance.wakeup.notify_all();
+
+		if(maintenance.thread.joinable()) {
+			maintenance.thread.join();
+		}
+
+	}
+
+	void SQLite::Database::checkpoint() {
+		if(checkpointer.connection) {
+			checkpoint(SQLITE_CHECKPOINT_PASSIVE);
+		} else {
+			save();
+		}
+	}
+
+	void SQLite::Database::save() {
+
+		if(memory.filename.empty()) {
+			return;
+		}
+
+		auto begin = chrono::steady_clock::now();
+
+		sqlite3 *file = nullptr;
+		if(sqlite3_open(memory.filename.c_str(), &file) != SQLITE_OK) {
+			string message{file ? sqlite3_errmsg(file) : "Out of memory"};
+			sqlite3_close(file);
+			throw runtime_error(Logger::String("Error opening '",memory.filename,"': ",message));
+		}
+
+		int rc;
+		sqlite3_backup *backup = nullptr;
+		{
+			lock_guard<recursive_mutex> lock(guard);
+			backup = (db ? sqlite3_backup_init(file, "main", db, "main") : nullptr);
+		}
+
+		if(!backup) {
+			string message{sqlite3_errmsg(file)};
+			sqlite3_close(file);
+			throw runtime_error(Logger::String("Error saving '",memory.filename,"': ",message));
+		}
+
+		// Copy in small steps releasing the connection between them; transactions hold it
+		// until commit, so the snapshot has no uncommitted rows, and changes made by
+		// this connection during the copy are applied to the backup by SQLite.
+		do {
+			{
+				lock_guard<recursive_mutex> lock(guard);
+				rc = sqlite3_backup_step(backup, 256);
+			}
+			if(rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+				sqlite3_sleep(100);
+			}
+		} while(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+		{
+			lock_guard<recursive_mutex> lock(guard);
+			sqlite3_backup_finish(backup);
+
+			if(rc == SQLITE_DONE) {
+				memory.saved = time(0);
+				memory.duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+				if(memory.duration > memory.max) {
+					memory.max = memory.duration;
+				}
+			}
+		}
+
+		if(rc != SQLITE_DONE) {
+			string message{sqlite3_errstr(rc)};
+			sqlite3_close(file);
+			throw runtime_error(Logger::String("Error saving '",memory.filename,"': ",message));
+		}
+
+		sqlite3_close(file);
+
+	}
+
+	void SQLite::Database::wal(time_t interval, unsigned int pages) {
+
+		if(!memory.filename.empty()) {
+			throw runtime_error("WAL mode requires a database file");
+		}
+
+		{
+			lock_guard<recursive_mutex> lock(guard);
+
+			if(!db) {
+				throw runtime_error("Database is not available");
+			}
+
+			const char *filename = sqlite3_db_filename(db,"main");
+			if(!(filename && *filename)) {
+				throw runtime_error("WAL mode requires a database file");
+			}
+
+			sqlite3_stmt *stmt = nullptr;
+			check(sqlite3_prepare_v2(db,"PRAGMA journal_mode=WAL",-1,&stmt,NULL));
+			string mode;
+			if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt,0)) {
+				mode = (const char *) sqlite3_column_text(stmt,0);
+			}
+			sqlite3_finalize(stmt);
+
+			if(strcasecmp(mode.c_str(),"wal")) {
+				throw runtime_error(Logger::String("Unable to set WAL mode, journal is '",mode,"'"));
+			}
+
+			// Checkpoints are made by the background thread on its own connection.
+			sqlite3_wal_autocheckpoint(db,0);
+
+			// The checkpointer connection has to read the database to get in WAL mode.
+			if(!checkpointer.connection && (
+					sqlite3_open_v2(filename,&checkpointer.connection,SQLITE_OPEN_READWRITE,nullptr) != SQLITE_OK
+					|| sqlite3_exec(checkpointer.connection,"PRAGMA journal_mode=WAL",NULL,NULL,NULL) != SQLITE_OK
+				)) {
+				string message{checkpointer.connection ? sqlite3_errmsg(checkpointer.connection) : "Out of memory"};
+				sqlite3_close(checkpointer.connection);
+				checkpointer.connection = nullptr;
+				throw runtime_error(Logger::String("Error opening WAL checkpointer: ",message));
+			}
+			sqlite3_wal_autocheckpoint(checkpointer.connection,0);
+
+			// Truncate waits for readers and writers, and writers wait for it (see busy()).
+			sqlite3_busy_timeout(checkpointer.connection,timeout);
+
+			{
+				lock_guard<mutex> lock(maintenance.guard);
+				checkpointer.interval = interval;
+				checkpointer.limit = (pages ? pages : 1);
+			}
+
+			sqlite3_wal_hook(db,commit,this);
+
+		}
+
+		cout << "sqlite\tWAL mode enabled, checkpoint every " << interval << " seconds or " << pages << " pages" << endl;
+
+		start(interval ? interval : 1);
+
+	}
+
+	int SQLite::Database::commit(void *context, sqlite3 *, const char *, int pages) {
+
+		Database *database = (Database *) context;
+
+		lock_guard<mutex> lock(database->maintenance.guard);
+		database->checkpointer.commits++;
+		database->checkpointer.pages = pages;
+		if(pages > database->checkpointer.highwater) {
+			database->checkpointer.highwater = pages;
+		}
+		if(pages >= database->checkpointer.limit && !database->maintenance.requested) {
+			database->maintenance.requested = true;
+			database->maintenance.wakeup.notify_one();
+		}
+
+		return SQLITE_OK;
+	}
+
+	void SQLite::Database::checkpoint(int mode) {
+
+		size_t commits;
+		{
+			lock_guard<mutex> lock(maintenance.guard);
+			commits = checkpointer.commits;
+		}
+
+		auto begin = chrono::steady_clock::now();
+
+		int log = 0, checkpointed = 0;
+		int rc = sqlite3_wal_checkpoint_v2(checkpointer.connection, "main", mode, &log, &checkpointed);
+
+		// Busy means readers or writers were active, the next checkpoint will get them.
+		if(rc != SQLITE_OK && rc != SQLITE_BUSY) {
+			throw runtime_error(Logger::String("WAL checkpoint failed: ",sqlite3_errmsg(checkpointer.connection)));
+		}
+
+		uint64_t duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+
+		lock_guard<mutex> lock(maintenance.guard);
+		checkpointer.checkpointed = commits;
+		checkpointer.duration = duration;
+		if(duration > checkpointer.max) {
+			checkpointer.max = duration;
+		}
+		if(rc == SQLITE_OK && mode == SQLITE_CHECKPOINT_TRUNCATE) {
+			checkpointer.pages = 0;
+		}
+
+	}
+
+ }
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/protocol.h>
+ #include <udjat/tools/http/client.h>
+ #include <udjat/tools/logger.h>
+ #include <cstring>
+ #include <ctime>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	std::shared_ptr<HTTP::Client> SQLite::Protocol::Connections::get(const char *url) {
+
+		lock_guard<mutex> lock(guard);
+
+		time_t now = time(0);
+		string name{SQLite::Endpoint{url}.to_string()};
+
+		auto ep = endpoints.begin();
+		while(ep != endpoints.end() && ep->name != name) {
+			ep++;
+		}
+
+		if(ep == endpoints.end()) {
+			endpoints.emplace_back();
+			ep = prev(endpoints.end());
+			ep->name = name;
+		}
+
+		ep->requests++;
+
+		for(auto entry = ep->entries.begin(); entry != ep->entries.end(); entry++) {
+			if(entry->url == url && (now - entry->last) < idle) {
+				ep->reused++;
+				entry->requests++;
+				entry->last = now;
+				ep->entries.splice(ep->entries.begin(),ep->entries,entry);
+				return ep->entries.front().client;
+			}
+		}
+
+		// No reusable client, drop the least recently used one if the endpoint is full.
+		while(!ep->entries.empty() && ep->entries.size() >= max) {
+			ep->entries.pop_back();
+		}
+
+		ep->entries.emplace_front();
+
+		Entry &entry = ep->entries.front();
+		entry.url = url;
+		entry.client = make_shared<HTTP::Client>(URL{url});
+		entry.last = now;
+		entry.requests = 1;
+
+		return entry.client;
+
+	}
+
+	void SQLite::Protocol::Connections::remove(const char *url) {
+
+		lock_guard<mutex> lock(guard);
+
+		string name{SQLite::Endpoint{url}.to_string()};
+		for(auto &ep : endpoints) {
+			if(ep.name == name) {
+				ep.entries.remove_if([url](const Entry &entry){
+					return entry.url == url;
+				});
+			}
+		}
+
+	}
+
+	void SQLite::Protocol::Connections::cleanup() {
+
+		lock_guard<mutex> lock(guard);
+
+		time_t now = time(0);
+		for(auto &ep : endpoints) {
+			ep.entries.remove_if([now,this](const Entry &entry){
+				return (now - entry.last) >= idle;
+			});
+		}
+
+	}
+
+	void SQLite::Protocol::Connections::get(Report &report) {
+
+		lock_guard<mutex> lock(guard);
+
+		report.start("endpoint","clients","requests","reused-clients","client-reuse-ratio",nullptr);
+
+		for(auto &ep : endpoints) {
+			report
+				<< ep.name
+				<< ep.entries.size()
+				<< ep.requests
+				<< ep.reused
+				<< (ep.requests ? (((double) ep.reused) / ((double) ep.requests)) : 0.0);
+		}
+
+	}
+
+ }
@@ -29,7 +29,7 @@
 
 	SQLite::Database::Database(const char *dbname) {
 
-		lock_guard<std::mutex> lock(guard);
+		lock_guard<std::recursive_mutex> lock(guard);
 
 		cout << "sqlite\tOpening database on '" << dbname << "'" << endl;
 
@@ -40,14 +40,90 @@
 			throw runtime_error(Logger::String("Error opening '",dbname,"'"));
         }
 
+		// Other processes can be writing on the same file (leased queues).
+		sqlite3_busy_timeout(db,timeout);
+
+		setup();
+
+	}
+
+	SQLite::Database::Database(const char *dbname, time_t checkpoint) {
+
+		{
+			lock_guard<std::recursive_mutex> lock(guard);
+
+			cout << "sqlite\tOpening in memory database from '" << dbname << "'" << endl;
+
+			int rc = sqlite3_open(":memory:", &db);
+			if(rc != SQLITE_OK) {
+				db = nullptr;
+				throw runtime_error("Error opening in memory database");
+			}
+
+			// Load the saved contents, if available.
+			sqlite3 *file = nullptr;
+			if(sqlite3_open_v2(dbname, &file, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+
+				sqlite3_backup *backup = sqlite3_backup_init(db, "main", file, "main");
+				rc = (backup ? sqlite3_backup_step(backup, -1) : SQLITE_ERROR);
+				if(backup) {
+					sqlite3_backup_finish(backup);
+				}
+
+				if(rc != SQLITE_DONE) {
+					string message{sqlite3_errmsg(db)};
+					sqlite3_close(file);
+					sqlite3_close(db);
+					db = nullptr;
+					throw runtime_error(Logger::String("Error loading '",dbname,"': ",message));
+				}
+
+				cout << "sqlite\tIn memory database loaded from '" << dbname << "'" << endl;
+
+			}
+			sqlite3_close(file);
+
+			memory.filename = dbname;
+			memory.interval = checkpoint;
+			memory.saved = time(0);
+
+			setup();
+		}
+
+		start(checkpoint);
+
 	}
 
 	SQLite::Database::~Database() {
 
 		debug("Closing database");
 
-		lock_guard<std::mutex> lock(guard);
+		stop();
+
+		// Final checkpoint.
+		if(checkpointer.connection) {
+			try {
+				checkpoint(SQLITE_CHECKPOINT_TRUNCATE);
+				cout << "sqlite\tFinal WAL checkpoint in " << checkpointer.duration << "ms" << endl;
+			} catch(const std::exception &e) {
+				cerr << "sqlite\t" << e.what() << endl;
+			}
+			sqlite3_close(checkpointer.connection);
+			checkpointer.connection = nullptr;
+		}
+
+		try {
+			save();
+			if(!memory.filename.empty()) {
+				cout << "sqlite\tIn memory database saved in " << memory.duration << "ms" << endl;
+			}
+		} catch(const std::exception &e) {
+			cerr << "sqlite\t" << e.what() << endl;
+		}
+
+		lock_guard<std::recursive_mutex> lock(guard);
 		if(db) {
+
 			switch(sqlite3_close(db)) {
 			case SQLITE_OK:
 					cout << "sqlite\tClosing database with NO unfinished operations" << endl;
@@ -66,6 +142,107 @@
 		}
 	}
 
+	void SQLite::Database::busy(unsigned int milliseconds) {
+		lock_guard<std::recursive_mutex> lock(guard);
+		timeout = milliseconds;
+		if(db) {
+			check(sqlite3_busy_timeout(db,timeout));
+		}
+		if(checkpointer.connection) {
+			sqlite3_busy_timeout(checkpointer.connection,timeout);
+		}
+	}
+
+	/// @brief The module database, owned by the module.
+	static struct {
+		std::mutex guard;
+		std::weak_ptr<SQLite::Database> database;
+	} instance;
+
+	std::shared_ptr<SQLite::Database> SQLite::Database::getInstance() {
+		lock_guard<mutex> lock(instance.guard);
+		return instance.database.lock();
+	}
+
+	void SQLite::Database::setInstance(std::shared_ptr<Database> database) {
+		lock_guard<mutex> lock(instance.guard);
+		instance.database = database;
+	}
+
+	std::shared_ptr<SQLite::Database> SQLite::Database::connect() {
+
+		string filename{name()};
+		if(!memory.filename.empty() || filename.empty()) {
+			return std::shared_ptr<Database>();
+		}
+
+		auto connection = make_shared<Database>(filename.c_str());
+		copy(*connection);
+
+		if(checkpointer.connection) {
+			lock_guard<std::recursive_mutex> lock(connection->guard);
+			sqlite3_wal_autocheckpoint(connection->db,0);
+			sqlite3_wal_hook(connection->db,commit,this);
+		}
+
+		return connection;
+
+	}
+
+	std::shared_ptr<SQLite::Database> SQLite::Database::open(const char *dbname) {
+
+		std::shared_ptr<Database> database;
+		if(memory.filename.empty()) {
+			database = make_shared<Database>(dbname);
+		} else {
+			database = make_shared<Database>(dbname,memory.interval);
+		}
+
+		copy(*database);
+
+		if(checkpointer.connection) {
+			time_t interval;
+			int pages;
+			{
+				lock_guard<mutex> lock(maintenance.guard);
+				interval = checkpointer.interval;
+				pages = checkpointer.limit;
+			}
+			database->wal(interval,(unsigned int) pages);
+		}
+
+		return database;
+
+	}
+
+	void SQLite::Database::copy(Database &connection) {
+
+		connection.busy(timeout);
+
+		if(kib) {
+			connection.cache(kib);
+		}
+
+		lock_guard<mutex> lock(profiler.guard);
+		if(profiler.enabled) {
+			// Report into this connection's statistics.
+			{
+				lock_guard<mutex> target(connection.profiler.guard);
+				connection.profiler.data = profiler.data;
+			}
+			connection.profile((unsigned int) (profiler.threshold / 1000000));
+		}
+
+	}
+
+	const char * SQLite::Database::name() const noexcept {
+		if(!memory.filename.empty()) {
+			return memory.filename.c_str();
+		}
+		const char *filename = (db ? sqlite3_db_filename(db,"main") : nullptr);
+		return filename ? filename : "";
+	}
+
 	void SQLite::Database::exec(const char *sql) {
 
 		char *errMsg = nullptr;
@@ -74,7 +251,7 @@
 			throw runtime_error("Database is not available");
 		}
 
-		lock_guard<std::mutex> lock(guard);
+		lock_guard<std::recursive_mutex> lock(guard);
 		if(sqlite3_exec(db,sql,NULL,NULL,&errMsg) != SQLITE_OK) {
 			string message{errMsg};
 			sqlite3_free(errMsg);
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include "private.h"
+ #include <cstring>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Endpoint::Endpoint(const char *url) {
+
+		const char *ptr = strstr(url,"://");
+		if(!ptr) {
+			host = url;
+			return;
+		}
+
+		scheme.assign(url,ptr-url);
+		ptr += 3;
+
+		const char *end = ptr + strcspn(ptr,"/?#");
+		const char *at = (const char *) memchr(ptr,'@',end-ptr);
+		if(at) {
+			ptr = at+1;
+		}
+
+		host.assign(ptr,end-ptr);
+
+		auto colon = host.rfind(':');
+		if(colon != string::npos && host.find(']',colon) == string::npos) {
+			port = host.substr(colon+1);
+			host.resize(colon);
+		} else if(!strcasecmp(scheme.c_str(),"https")) {
+			port = "443";
+		} else if(!strcasecmp(scheme.c_str(),"http")) {
+			port = "80";
+		}
+
+	}
+
+	std::string SQLite::Endpoint::to_string() const {
+		if(scheme.empty()) {
+			return host;
+		}
+		return scheme + "://" + host + ":" + port;
+	}
+
+	uint64_t SQLite::hash(const void *data, size_t length, uint64_t value) noexcept {
+		const uint8_t *ptr = (const uint8_t *) data;
+		while(length--) {
+			value ^= *(ptr++);
+			value *= 0x100000001b3ULL;
+		}
+		return value;
+	}
+
+ }
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief SQL functions registered on the module database.
+  *
+  * url_scheme(url), url_host(url), url_port(url)	URL components (deterministic).
+  * payload_hash(text)								64 bit FNV-1a hash (deterministic).
+  * expand(text)									Text with udjat ${} variables expanded.
+  * backoff(host)									Seconds remaining on host backoff (0 if none).
+  *
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/tools/string.h>
+ #include <ctime>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	static void url_scheme(sqlite3_context *context, int, sqlite3_value **argv) {
+		const char *url = (const char *) sqlite3_value_text(argv[0]);
+		if(!url) {
+			sqlite3_result_null(context);
+			return;
+		}
+		string value{SQLite::Endpoint{url}.scheme};
+		sqlite3_result_text(context,value.c_str(),value.size(),SQLITE_TRANSIENT);
+	}
+
+	static void url_host(sqlite3_context *context, int, sqlite3_value **argv) {
+		const char *url = (const char *) sqlite3_value_text(argv[0]);
+		if(!url) {
+			sqlite3_result_null(context);
+			return;
+		}
+		string value{SQLite::Endpoint{url}.host};
+		sqlite3_result_text(context,value.c_str(),value.size(),SQLITE_TRANSIENT);
+	}
+
+	static void url_port(sqlite3_context *context, int, sqlite3_value **argv) {
+		const char *url = (const char *) sqlite3_value_text(argv[0]);
+		if(!url) {
+			sqlite3_result_null(context);
+			return;
+		}
+		string value{SQLite::Endpoint{url}.port};
+		if(value.empty()) {
+			sqlite3_result_null(context);
+			return;
+		}
+		sqlite3_result_int(context,atoi(value.c_str()));
+	}
+
+	static void payload_hash(sqlite3_context *context, int, sqlite3_value **argv) {
+		const void *data = sqlite3_value_blob(argv[0]);
+		if(!data) {
+			sqlite3_result_null(context);
+			return;
+		}
+		sqlite3_result_int64(context,(sqlite3_int64) SQLite::hash(data,sqlite3_value_bytes(argv[0])));
+	}
+
+	static void expand(sqlite3_context *context, int, sqlite3_value **argv) {
+		const char *text = (const char *) sqlite3_value_text(argv[0]);
+		if(!text) {
+			sqlite3_result_null(context);
+			return;
+		}
+		try {
+			String value{text};
+			value.expand(true,true);
+			sqlite3_result_text(context,value.c_str(),value.size(),SQLITE_TRANSIENT);
+		} catch(const std::exception &e) {
+			sqlite3_result_error(context,e.what(),-1);
+		}
+	}
+
+	static void host_backoff(sqlite3_context *context, int, sqlite3_value **argv) {
+		const char *host = (const char *) sqlite3_value_text(argv[0]);
+		if(!host) {
+			sqlite3_result_int(context,0);
+			return;
+		}
+		SQLite::Database *database = (SQLite::Database *) sqlite3_user_data(context);
+		sqlite3_result_int64(context,(sqlite3_int64) database->backoff(host));
+	}
+
+	void SQLite::Database::setup() {
+
+		static const struct {
+			const char *name;
+			int flags;
+			void (*method)(sqlite3_context *, int, sqlite3_value **);
+		} functions[] = {
+			{ "url_scheme",		SQLITE_UTF8|SQLITE_DETERMINISTIC,	url_scheme		},
+			{ "url_host",		SQLITE_UTF8|SQLITE_DETERMINISTIC,	url_host		},
+			{ "url_port",		SQLITE_UTF8|SQLITE_DETERMINISTIC,	url_port		},
+			{ "payload_hash",	SQLITE_UTF8|SQLITE_DETERMINISTIC,	payload_hash	},
+			{ "expand",			SQLITE_UTF8,						expand			},
+			{ "backoff",		SQLITE_UTF8,						host_backoff	},
+		};
+
+		for(const auto &function : functions) {
+			check(
+				sqlite3_create_function_v2(
+					db,
+					function.name,
+					1,
+					function.flags,
+					this,
+					function.method,
+					NULL,
+					NULL,
+					NULL
+				)
+			);
+		}
+
+	}
+
+	void SQLite::Database::backoff(const char *host, time_t seconds) {
+		lock_guard<mutex> lock(backoffs.guard);
+		if(seconds) {
+			backoffs.hosts[host] = time(0) + seconds;
+		} else {
+			backoffs.hosts.erase(host);
+		}
+	}
+
+	time_t SQLite::Database::backoff(const char *host) {
+
+		lock_guard<mutex> lock(backoffs.guard);
+
+		auto entry = backoffs.hosts.find(host);
+		if(entry == backoffs.hosts.end()) {
+			return 0;
+		}
+
+		time_t now = time(0);
+		if(entry->second <= now) {
+			backoffs.hosts.erase(entry);
+			return 0;
+		}
+
+		return entry->second - now;
+
+	}
+
+ }
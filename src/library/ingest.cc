@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <udjat/sqlite/ingest.h>
+ #include <udjat/tools/logger.h>
+ #include <iostream>
+ #include <chrono>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Ingest::Ingest(std::shared_ptr<Database> db, size_t l, size_t b, const Writer &w, const Complete &c)
+		: database{db}, connection{db->connect()}, head{&stub}, tail{&stub}, limit{l}, batch{b ? b : 1}, writer{w}, complete{c} {
+
+		// Batches on the shared connection would hold it until commit.
+		if(!connection) {
+			connection = database;
+		}
+
+		thread = std::thread([this](){
+
+			unique_lock<mutex> lock(guard);
+			while(enabled || length.load()) {
+
+				if(!length.load()) {
+					wakeup.wait_for(lock,chrono::milliseconds(500));
+					continue;
+				}
+
+				// When stopping, keep storing batches until the deadline.
+				if(expired()) {
+					break;
+				}
+
+				lock.unlock();
+				try {
+
+					flush(batch);
+
+				} catch(const std::exception &e) {
+
+					cerr << "sqlite\tError storing buffered records: " << e.what() << endl;
+
+				}
+				lock.lock();
+
+			}
+
+		});
+
+	}
+
+	SQLite::Ingest::~Ingest() {
+		stop();
+	}
+
+	void SQLite::Ingest::stop() {
+		stop(chrono::steady_clock::time_point::max());
+	}
+
+	size_t SQLite::Ingest::stop(const std::chrono::steady_clock::time_point &limit) {
+
+		{
+			lock_guard<mutex> lock(guard);
+			if(enabled) {
+				deadline = limit;
+			}
+			enabled = false;
+		}
+		wakeup.notify_all();
+
+		if(thread.joinable()) {
+			thread.join();
+		}
+
+		// Records pushed while the consumer was exiting.
+		while(length.load() && !expired()) {
+			try {
+				flush(batch);
+			} catch(const std::exception &e) {
+				cerr << "sqlite\tError storing buffered records: " << e.what() << endl;
+				break;
+			}
+		}
+
+		// Deadline reached, release the records left.
+		size_t discarded = 0;
+		while(Node *node = pop()) {
+			delete node;
+			discarded++;
+		}
+		length.fetch_sub(discarded);
+
+		if(discarded) {
+			cerr << "sqlite\tShutdown deadline reached, " << discarded << " buffered record(s) not stored" << endl;
+		}
+
+		return discarded;
+
+	}
+
+	bool SQLite::Ingest::push(Record &&record) {
+
+		if(!enabled) {
+			return false;
+		}
+
+		// Reserve a slot, refuse when full so the producer gets back pressure.
+		size_t pending = length.fetch_add(1);
+		if(pending >= limit) {
+			length.fetch_sub(1);
+			return false;
+		}
+
+		Node *node = new Node();
+		node->record = std::move(record);
+
+		Node *prev = head.exchange(node,memory_order_acq_rel);
+		prev->next.store(node,memory_order_release);
+
+		if(!pending) {
+			wakeup.notify_one();
+		}
+
+		return true;
+
+	}
+
+	SQLite::Ingest::Node * SQLite::Ingest::pop() {
+
+		Node *current = tail;
+		Node *next = current->next.load(memory_order_acquire);
+
+		if(current == &stub) {
+			if(!next) {
+				return nullptr;
+			}
+			tail = next;
+			current = next;
+			next = next->next.load(memory_order_acquire);
+		}
+
+		if(next) {
+			tail = next;
+			return current;
+		}
+
+		if(current != head.load(memory_order_acquire)) {
+			// A producer is still linking its node.
+			return nullptr;
+		}
+
+		// Last node, put the stub back to release it.
+		stub.next.store(nullptr,memory_order_relaxed);
+		Node *prev = head.exchange(&stub,memory_order_acq_rel);
+		prev->next.store(&stub,memory_order_release);
+
+		next = current->next.load(memory_order_acquire);
+		if(next) {
+			tail = next;
+			return current;
+		}
+
+		return nullptr;
+
+	}
+
+	size_t SQLite::Ingest::flush(size_t max) {
+
+		std::vector<Node *> nodes;
+		while(nodes.size() < max) {
+			Node *node = pop();
+			if(!node) {
+				break;
+			}
+			nodes.push_back(node);
+		}
+
+		if(nodes.empty()) {
+			// Producer was preempted while linking, give it some time.
+			this_thread::yield();
+			return 0;
+		}
+
+		// Rows are counted only after the commit, a failed batch is retried.
+		size_t stored = 0;
+
+		try {
+
+			Transaction transaction{connection};
+			std::unique_ptr<Statement> stmt;
+			const char *sql = "";
+
+			for(auto node : nodes) {
+
+				if(!stmt || node->record.sql != sql) {
+					stmt.reset(new Statement(connection,node->record.sql.c_str()));
+					sql = node->record.sql.c_str();
+				}
+
+				if(writer(connection,*stmt,node->record)) {
+					stored++;
+				}
+				stmt->reset();
+
+			}
+
+			stmt.reset();
+			transaction.commit();
+
+		} catch(const std::exception &e) {
+
+			// Batch failed, try them one by one to avoid losing all of them.
+			cerr << "sqlite\tError storing " << nodes.size() << " buffered record(s): " << e.what() << endl;
+
+			stored = 0;
+			for(auto node : nodes) {
+				try {
+					Transaction transaction{connection};
+					Statement stmt{connection,node->record.sql.c_str()};
+					bool inserted = writer(connection,stmt,node->record);
+					transaction.commit();
+					if(inserted) {
+						stored++;
+					}
+				} catch(const std::exception &e) {
+					cerr << "sqlite\tUnable to store buffered request to '" << node->record.url << "': " << e.what() << endl;
+				}
+			}
+
+		}
+
+		if(complete) {
+			complete(stored);
+		}
+
+		for(auto node : nodes) {
+			delete node;
+		}
+
+		length.fetch_sub(nodes.size());
+		return nodes.size();
+
+	}
+
+ }
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/tools/report.h>
+ #include <iostream>
+ #include <string>
+ #include <ctime>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	void SQLite::Database::limits(int64_t soft, int64_t hard) {
+
+		if(soft) {
+			sqlite3_soft_heap_limit64(soft);
+			cout << "sqlite\tSoft heap limit set to " << soft << " bytes" << endl;
+		}
+
+		if(hard) {
+#if SQLITE_VERSION_NUMBER >= 3031000
+			sqlite3_hard_heap_limit64(hard);
+			cout << "sqlite\tHard heap limit set to " << hard << " bytes" << endl;
+#else
+			cerr << "sqlite\tHard heap limit requires SQLite 3.31 or newer, ignoring it" << endl;
+#endif // SQLITE_VERSION_NUMBER
+		}
+
+	}
+
+	void SQLite::Database::cache(size_t kib) {
+		// Negative values are in KiB.
+		exec((string{"PRAGMA cache_size=-"} + std::to_string(kib)).c_str());
+		this->kib = kib;
+	}
+
+	void SQLite::Database::release() {
+		lock_guard<std::recursive_mutex> lock(guard);
+		if(db) {
+			sqlite3_db_release_memory(db);
+		}
+	}
+
+	void SQLite::Database::status(Report &report) {
+
+		report.start("name","current","highwater",nullptr);
+
+		static const struct {
+			const char *name;
+			int op;
+		} globals[] = {
+			{ "memory-used",			SQLITE_STATUS_MEMORY_USED			},
+			{ "malloc-count",			SQLITE_STATUS_MALLOC_COUNT			},
+			{ "pagecache-used",			SQLITE_STATUS_PAGECACHE_USED		},
+			{ "pagecache-overflow",		SQLITE_STATUS_PAGECACHE_OVERFLOW	},
+		};
+
+		for(auto &counter : globals) {
+			sqlite3_int64 current = 0, highwater = 0;
+			if(sqlite3_status64(counter.op,&current,&highwater,0) == SQLITE_OK) {
+				report << counter.name << (int64_t) current << (int64_t) highwater;
+			}
+		}
+
+		static const struct {
+			const char *name;
+			int op;
+		} connection[] = {
+			{ "cache-used",				SQLITE_DBSTATUS_CACHE_USED			},
+			{ "cache-hit",				SQLITE_DBSTATUS_CACHE_HIT			},
+			{ "cache-miss",				SQLITE_DBSTATUS_CACHE_MISS			},
+			{ "cache-write",			SQLITE_DBSTATUS_CACHE_WRITE			},
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+			{ "cache-spill",			SQLITE_DBSTATUS_CACHE_SPILL			},
+#endif // SQLITE_DBSTATUS_CACHE_SPILL
+			{ "schema-used",			SQLITE_DBSTATUS_SCHEMA_USED			},
+			{ "stmt-used",				SQLITE_DBSTATUS_STMT_USED			},
+			{ "lookaside-used",			SQLITE_DBSTATUS_LOOKASIDE_USED		},
+			{ "lookaside-hit",			SQLITE_DBSTATUS_LOOKASIDE_HIT		},
+			{ "lookaside-miss-size",	SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE	},
+			{ "lookaside-miss-full",	SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL	},
+		};
+
+		lock_guard<std::recursive_mutex> lock(guard);
+		if(!db) {
+			return;
+		}
+
+		for(auto &counter : connection) {
+			int current = 0, highwater = 0;
+			if(sqlite3_db_status(db,counter.op,&current,&highwater,0) == SQLITE_OK) {
+				report << counter.name << (int64_t) current << (int64_t) highwater;
+			}
+		}
+
+		report << "statement-timeouts" << (int64_t) aborted.timeouts.load() << (int64_t) 0;
+		report << "statement-cancels" << (int64_t) aborted.cancelled.load() << (int64_t) 0;
+
+		if(!memory.filename.empty()) {
+			// In memory database: last/slowest save and seconds of changes not yet on disk.
+			report << "checkpoint-time" << (int64_t) memory.duration << (int64_t) memory.max;
+			report << "data-at-risk" << (int64_t) (time(0) - memory.saved) << (int64_t) memory.interval;
+		}
+
+		if(checkpointer.connection) {
+			lock_guard<std::mutex> lock(maintenance.guard);
+			report << "wal-pages" << (int64_t) checkpointer.pages << (int64_t) checkpointer.highwater;
+			report << "wal-checkpoint-time" << (int64_t) checkpointer.duration << (int64_t) checkpointer.max;
+		}
+
+	}
+
+ }
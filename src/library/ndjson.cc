@@ -0,0 +1,484 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <udjat/sqlite/protocol.h>
+ #include <udjat/tools/string.h>
+ #include <udjat/tools/logger.h>
+ #include <string>
+ #include <string_view>
+ #include <fstream>
+ #include <limits>
+ #include <algorithm>
+ #include <cstdio>
+ #include <cstring>
+ #include <cerrno>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Size of the export buffer.
+	static const size_t buffer_size = 65536;
+
+	/// @brief Rows on each export query.
+	static const int64_t page_size = 1000;
+
+	/// @brief Rows on each import transaction when it runs on the shared connection (in-memory databases).
+	static const size_t shared_batch = 100;
+
+	static void escape(string &buffer, const std::string_view &value) {
+
+		buffer += '"';
+		for(unsigned char chr : value) {
+			switch(chr) {
+			case '"':
+				buffer += "\\\"";
+				break;
+
+			case '\\':
+				buffer += "\\\\";
+				break;
+
+			case '\n':
+				buffer += "\\n";
+				break;
+
+			case '\r':
+				buffer += "\\r";
+				break;
+
+			case '\t':
+				buffer += "\\t";
+				break;
+
+			default:
+				if(chr < 0x20) {
+					char hex[7];
+					snprintf(hex,sizeof(hex),"\\u%04x",(unsigned int) chr);
+					buffer += hex;
+				} else {
+					buffer += (char) chr;
+				}
+			}
+		}
+		buffer += '"';
+
+	}
+
+	static void utf8(string &value, unsigned long code) {
+		if(code < 0x80) {
+			value += (char) code;
+		} else if(code < 0x800) {
+			value += (char) (0xC0 | (code >> 6));
+			value += (char) (0x80 | (code & 0x3F));
+		} else if(code < 0x10000) {
+			value += (char) (0xE0 | (code >> 12));
+			value += (char) (0x80 | ((code >> 6) & 0x3F));
+			value += (char) (0x80 | (code & 0x3F));
+		} else {
+			value += (char) (0xF0 | (code >> 18));
+			value += (char) (0x80 | ((code >> 12) & 0x3F));
+			value += (char) (0x80 | ((code >> 6) & 0x3F));
+			value += (char) (0x80 | (code & 0x3F));
+		}
+	}
+
+	/// @brief Parse JSON string, 'ptr' is after the opening quote and ends after the closing one.
+	static bool unescape(const char * &ptr, string &value) {
+
+		value.clear();
+		while(*ptr && *ptr != '"') {
+
+			if(*ptr != '\\') {
+				value += *(ptr++);
+				continue;
+			}
+
+			switch(*(++ptr)) {
+			case 'n':
+				value += '\n';
+				break;
+
+			case 'r':
+				value += '\r';
+				break;
+
+			case 't':
+				value += '\t';
+				break;
+
+			case 'b':
+				value += '\b';
+				break;
+
+			case 'f':
+				value += '\f';
+				break;
+
+			case 'u':
+				{
+					char *end = nullptr;
+					string hex{ptr+1,strnlen(ptr+1,4)};
+					unsigned long code = strtoul(hex.c_str(),&end,16);
+					if(hex.size() != 4 || *end) {
+						return false;
+					}
+					ptr += 4;
+
+					// Surrogate pair.
+					if(code >= 0xD800 && code < 0xDC00 && ptr[1] == '\\' && ptr[2] == 'u') {
+						string low{ptr+3,strnlen(ptr+3,4)};
+						unsigned long second = strtoul(low.c_str(),&end,16);
+						if(low.size() == 4 && !*end && second >= 0xDC00 && second < 0xE000) {
+							code = 0x10000 + ((code - 0xD800) << 10) + (second - 0xDC00);
+							ptr += 6;
+						}
+					}
+
+					utf8(value,code);
+				}
+				break;
+
+			case '\0':
+				return false;
+
+			default:
+				// '"', '\\' and '/'.
+				value += *ptr;
+			}
+			ptr++;
+
+		}
+
+		if(*ptr != '"') {
+			return false;
+		}
+		ptr++;
+		return true;
+
+	}
+
+	/// @brief Parse an exported request (flat JSON object).
+	static bool parse(const char *ptr, SQLite::Ingest::Record &record) {
+
+		string name, value;
+
+		while(isspace(*ptr)) {
+			ptr++;
+		}
+
+		if(*(ptr++) != '{') {
+			return false;
+		}
+
+		for(;;) {
+
+			while(isspace(*ptr) || *ptr == ',') {
+				ptr++;
+			}
+
+			if(*ptr == '}') {
+				break;
+			}
+
+			if(*(ptr++) != '"' || !unescape(ptr,name)) {
+				return false;
+			}
+
+			while(isspace(*ptr)) {
+				ptr++;
+			}
+
+			if(*(ptr++) != ':') {
+				return false;
+			}
+
+			while(isspace(*ptr)) {
+				ptr++;
+			}
+
+			if(*ptr == '"') {
+
+				ptr++;
+				if(!unescape(ptr,value)) {
+					return false;
+				}
+
+				if(name == "url") {
+					record.url = value;
+				} else if(name == "verb") {
+					record.verb = value;
+				} else if(name == "payload") {
+					record.payload = value;
+				}
+
+			} else {
+
+				// Not a string (the id), ignore it.
+				while(*ptr && *ptr != ',' && *ptr != '}') {
+					ptr++;
+				}
+
+			}
+
+			if(!*ptr) {
+				return false;
+			}
+
+		}
+
+		return !(record.url.empty() || record.verb.empty());
+
+	}
+
+	size_t SQLite::Protocol::dump(const char *filename) {
+
+		if(!(ndjson.sql && *ndjson.sql)) {
+			throw runtime_error("The queue has no 'export' query");
+		}
+
+		FILE *out = fopen(filename,"w");
+		if(!out) {
+			throw runtime_error(Logger::String("Can't open '",filename,"': ",strerror(errno)));
+		}
+
+		string buffer;
+		buffer.reserve(buffer_size * 2);
+
+		size_t count = 0;
+
+		try {
+
+			for(auto &shard : shards) {
+
+				// Keyset iteration, one page on each query; the connection is free between them.
+				int64_t last = std::numeric_limits<int64_t>::min();
+				for(;;) {
+
+					int64_t rows = 0;
+
+					Statement stmt{shard->database,ndjson.sql};
+					stmt.bind(1,last);
+					stmt.bind(2,page_size);
+
+					for(auto [id, url, verb, payload] : stmt.rows<int64_t,std::string_view,std::string_view,std::string_view>()) {
+
+						buffer += "{\"id\":";
+						buffer += std::to_string(id);
+						buffer += ",\"url\":";
+						escape(buffer,url);
+						buffer += ",\"verb\":";
+						escape(buffer,verb);
+						buffer += ",\"payload\":";
+						escape(buffer,payload);
+						buffer += "}\n";
+
+						if(buffer.size() >= buffer_size) {
+							if(fwrite(buffer.data(),buffer.size(),1,out) != 1) {
+								throw runtime_error(Logger::String("Error writing '",filename,"': ",strerror(errno)));
+							}
+							buffer.clear();
+						}
+
+						last = id;
+						rows++;
+
+					}
+
+					count += rows;
+					if(rows < page_size) {
+						break;
+					}
+
+				}
+
+			}
+
+			if(!buffer.empty() && fwrite(buffer.data(),buffer.size(),1,out) != 1) {
+				throw runtime_error(Logger::String("Error writing '",filename,"': ",strerror(errno)));
+			}
+
+		} catch(...) {
+
+			fclose(out);
+			throw;
+
+		}
+
+		if(fclose(out)) {
+			throw runtime_error(Logger::String("Error writing '",filename,"': ",strerror(errno)));
+		}
+
+		info() << "Exported " << count << " request(s) to '" << filename << "'" << endl;
+		return count;
+
+	}
+
+	/// @brief Save the number of imported lines, replacing the progress file atomically.
+	static void progress(const string &filename, size_t lines) {
+
+		string temp{filename + ".tmp"};
+		{
+			ofstream out{temp};
+			out << lines << endl;
+			if(!out) {
+				throw runtime_error(Logger::String("Error writing '",temp,"'"));
+			}
+		}
+
+		if(rename(temp.c_str(),filename.c_str())) {
+			throw runtime_error(Logger::String("Can't rename '",temp,"': ",strerror(errno)));
+		}
+
+	}
+
+	size_t SQLite::Protocol::imported(const char *filename) {
+		size_t lines = 0;
+		ifstream in{string{filename} + ".progress"};
+		if(!(in >> lines)) {
+			return 0;
+		}
+		return lines;
+	}
+
+	size_t SQLite::Protocol::load(const char *filename, size_t batch) {
+
+		ifstream in{filename};
+		if(!in) {
+			throw runtime_error(Logger::String("Can't open '",filename,"'"));
+		}
+
+		if(!batch) {
+			batch = 1;
+		}
+
+		// Lines committed by a previous import of this file, skip them.
+		string status{string{filename} + ".progress"};
+		size_t skip = imported(filename);
+		if(skip) {
+			info() << "Resuming import of '" << filename << "' after line " << skip << endl;
+		}
+
+		String sql{ins};
+		sql.expand(true,true);
+
+		// Import on dedicated connections, so the batch transactions don't hold the shared
+		// connection used by the live queue; in-memory databases have only one connection,
+		// use small batches on them.
+		std::vector<std::shared_ptr<Database>> databases(shards.size());
+		for(size_t ix = 0; ix < shards.size(); ix++) {
+			databases[ix] = shards[ix]->database->connect();
+			if(!databases[ix]) {
+				databases[ix] = shards[ix]->database;
+				batch = std::min(batch,shared_batch);
+			}
+		}
+
+		// One prepared statement and one open transaction for each shard.
+		std::vector<std::unique_ptr<Statement>> statements(shards.size());
+		std::vector<std::unique_ptr<Transaction>> transactions(shards.size());
+
+		// Queue sizes are updated after each commit.
+		std::vector<size_t> stored(shards.size(),0);
+
+		size_t count = 0, invalid = 0, lines = 0;
+
+		auto commit = [this,&transactions,&stored,&status,&lines]() {
+			bool committed = false;
+			for(size_t ix = 0; ix < transactions.size(); ix++) {
+				if(transactions[ix]) {
+					transactions[ix]->commit();
+					transactions[ix].reset();
+					enqueued(*shards[ix],stored[ix]);
+					stored[ix] = 0;
+					committed = true;
+				}
+			}
+			if(committed) {
+				progress(status,lines);
+			}
+		};
+
+		string line;
+
+		while(getline(in,line)) {
+
+			if(++lines <= skip) {
+				continue;
+			}
+
+			SQLite::Ingest::Record record{sql,"","",""};
+			if(!parse(line.c_str(),record)) {
+				if(!line.empty()) {
+					invalid++;
+				}
+				continue;
+			}
+
+			Shard &target = shard(record.url.c_str());
+			size_t ix = 0;
+			while(shards[ix].get() != &target) {
+				ix++;
+			}
+
+			if(!statements[ix]) {
+				statements[ix].reset(new Statement(databases[ix],record.sql.c_str()));
+			}
+
+			if(!transactions[ix]) {
+				transactions[ix].reset(new Transaction(databases[ix]));
+			}
+
+			if(store(databases[ix],*statements[ix],record)) {
+				stored[ix]++;
+			}
+			statements[ix]->reset();
+
+			if(++count % batch == 0) {
+				commit();
+			}
+
+		}
+
+		commit();
+
+		// Complete, the next import of this file starts from the beginning.
+		std::remove(status.c_str());
+
+		if(invalid) {
+			warning() << "Ignored " << invalid << " invalid line(s) from '" << filename << "'" << endl;
+		}
+
+		info() << "Imported " << count << " request(s) from '" << filename << "'" << endl;
+
+		if(count) {
+			refresh();
+		}
+
+		return count;
+
+	}
+
+ }
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #pragma once
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <string>
+ #include <cstdint>
+ #include <cstddef>
+
+ namespace Udjat {
+
+	namespace SQLite {
+
+		/// @brief Scheme, host and port from an URL.
+		class UDJAT_PRIVATE Endpoint {
+		public:
+			std::string scheme;
+			std::string host;
+			std::string port;
+
+			Endpoint(const char *url);
+
+			/// @brief Get endpoint as scheme://host:port.
+			std::string to_string() const;
+
+		};
+
+		/// @brief 64 bit FNV-1a hash.
+		UDJAT_PRIVATE uint64_t hash(const void *data, size_t length, uint64_t seed = 0xcbf29ce484222325ULL) noexcept;
+
+	}
+
+ }
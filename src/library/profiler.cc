@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/tools/logger.h>
+ #include <udjat/tools/report.h>
+ #include <vector>
+ #include <algorithm>
+ #include <iostream>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	int SQLite::Database::trace(unsigned int type, void *context, void *p, void *x) {
+
+		if(type != SQLITE_TRACE_PROFILE) {
+			return 0;
+		}
+
+		Database *database = (Database *) context;
+		sqlite3_stmt *stmt = (sqlite3_stmt *) p;
+		uint64_t time = *((sqlite3_int64 *) x);
+
+		const char *sql = sqlite3_sql(stmt);
+		if(!sql) {
+			return 0;
+		}
+
+		// Get and reset counters for this run.
+		uint64_t steps = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_VM_STEP,1);
+		uint64_t scans = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_FULLSCAN_STEP,1);
+		uint64_t sorts = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_SORT,1);
+
+		{
+			Profile &profile = *database->profiler.data;
+			lock_guard<mutex> lock(profile.guard);
+
+			// Expanded SQL (like the queue insert) can produce a new text on each call, keep the map bounded.
+			auto &statements = profile.statements;
+			bool full = (statements.size() >= profile.limit && statements.find(sql) == statements.end());
+
+			auto &statistics = statements[full ? "(other statements)" : sql];
+			statistics.calls++;
+			statistics.time += time;
+			statistics.steps += steps;
+			statistics.scans += scans;
+			statistics.sorts += sorts;
+			if(time > statistics.max) {
+				statistics.max = time;
+			}
+		}
+
+		uint64_t threshold = database->profiler.threshold.load();
+		if(threshold && time >= threshold) {
+			Logger::String{
+				"Slow statement (",(time/1000000),"ms, ",steps," steps, ",scans," full scan steps, ",sorts," sorts): ",sql
+			}.write(Logger::Warning,"sqlite");
+		}
+
+		return 0;
+
+	}
+
+	void SQLite::Database::profile(unsigned int threshold) {
+
+		lock_guard<std::recursive_mutex> lock(guard);
+		lock_guard<mutex> settings(profiler.guard);
+
+		profiler.threshold = ((uint64_t) threshold) * 1000000;
+		if(!profiler.enabled) {
+			check(sqlite3_trace_v2(db,SQLITE_TRACE_PROFILE,trace,this));
+			profiler.enabled = true;
+		}
+
+		cout << "sqlite\tProfiling statements, logging the ones slower than " << threshold << "ms" << endl;
+
+	}
+
+	void SQLite::Database::profile(Report &report, size_t limit) {
+
+		// Includes the connections copied from this one (shards, ingest and cache).
+		std::vector<std::pair<std::string,Statistics>> statements;
+
+		{
+			Profile &profile = *profiler.data;
+			lock_guard<mutex> lock(profile.guard);
+			statements.assign(profile.statements.begin(),profile.statements.end());
+		}
+
+		// Top statements by total time.
+		std::sort(statements.begin(),statements.end(),[](const auto &a, const auto &b){
+			return a.second.time > b.second.time;
+		});
+
+		if(statements.size() > limit) {
+			statements.resize(limit);
+		}
+
+		report.start("sql","calls","total","average","max","steps","scans","sorts",nullptr);
+
+		for(auto &statement : statements) {
+			const auto &statistics = statement.second;
+			report
+				<< statement.first
+				<< statistics.calls
+				<< (statistics.time / 1000000.0)
+				<< (statistics.calls ? (statistics.time / (statistics.calls * 1000000.0)) : 0.0)
+				<< (statistics.max / 1000000.0)
+				<< statistics.steps
+				<< statistics.scans
+				<< statistics.sorts;
+		}
+
+	}
+
+ }
@@ -18,22 +18,31 @@
  */
 
  #include <config.h>
+ #include "private.h"
  #include <pugixml.hpp>
  #include <udjat/sqlite/sql.h>
  #include <udjat/agent/abstract.h>
  #include <udjat/tools/quark.h>
  #include <udjat/tools/http/client.h>
+ #include <udjat/tools/http/exception.h>
  #include <udjat/moduleinfo.h>
  #include <udjat/sqlite/database.h>
  #include <udjat/sqlite/statement.h>
  #include <udjat/sqlite/protocol.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <udjat/sqlite/blob.h>
  #include <udjat/tools/mainloop.h>
  #include <udjat/tools/timestamp.h>
  #include <udjat/tools/systemservice.h>
  #include <udjat/tools/logger.h>
- #include <udjat/tools/threadpool.h>
  #include <udjat/tools/intl.h>
  #include <string>
+ #include <cstring>
+ #include <algorithm>
+ #include <random>
+ #include <cstdio>
+ #include <cerrno>
+ #include <sys/stat.h>
 
 #ifndef _WIN32
 	#include <unistd.h>
@@ -59,15 +68,41 @@
 	}
 
 	int64_t SQLite::Protocol::count() const {
+		int64_t total = 0;
+		for(auto &shard : shards) {
+			total += count(*shard);
+		}
+		return total;
+	}
+
+	int64_t SQLite::Protocol::count(const Shard &shard) const {
 		int64_t pending_messages = 0;
 		if(pending && *pending) {
-			Statement sql{database,pending};
-			sql.step();
-			sql.get(0,pending_messages);
+			Statement sql{shard.database,pending};
+			sql.timeout(timeouts.pending).cancellable(cancellation);
+			if(sql.step() == SQLITE_ROW) {
+				std::tie(pending_messages) = sql.row<int64_t>();
+			}
 		}
+		shard.queued = pending_messages;
 		return pending_messages;
 	}
 
+	namespace {
+
+	/// @brief Message based state, immutable since readers keep the summary pointer.
+	class StringState : public Abstract::State {
+	private:
+		const std::string message;
+
+	public:
+		StringState(const char *name, Level level, const std::string &msg) : Abstract::State(name,level), message{msg} {
+			Object::properties.summary = message.c_str();
+		}
+	};
+
+	}
+
 	static const Udjat::ModuleInfo moduleinfo{"SQLite " SQLITE_VERSION " custom protocol module"};
 
 	SQLite::Protocol::Protocol(	std::shared_ptr<Database> db, const pugi::xml_node &node) :
@@ -75,12 +110,144 @@
 		database{db},
 		ins{child_value(node,"insert")},
 		del{child_value(node,"delete")},
-		select{child_value(node,"select")},
+		select{child_value(node,"select",!node.child("claim"))},
 		list{child_value(node,"report",false)},
 		pending{child_value(node,"pending",false)} {
 
+		shards.emplace_back(new Shard{db});
+
+		{
+			size_t count = Object::getAttribute(node, "sqlite", "shards", (unsigned int) 1);
+			if(count > 1) {
+
+				// Extra shards are on '<dbname>.<shard>', each with its own connection and the module settings.
+				string dbname{db->name()};
+				if(dbname.empty()) {
+					throw runtime_error("Sharded queues require a database file");
+				}
+
+				for(size_t shard = 1; shard < count; shard++) {
+					shards.emplace_back(new Shard{db->open((dbname + "." + std::to_string(shard)).c_str())});
+				}
+
+				const char *mode = node.attribute("shard-by").as_string("host");
+				if(!strcasecmp(mode,"round-robin")) {
+					distribution = RoundRobin;
+				} else if(strcasecmp(mode,"host")) {
+					throw runtime_error(Logger::String("Unexpected shard-by mode '",mode,"'"));
+				}
+
+				if(distribution == RoundRobin && strstr(ins,":key")) {
+					warning() << "Duplicated requests can be stored on different shards, use shard-by='host' to deduplicate them" << endl;
+				}
+
+				info() << "Queue spread across " << count << " shards by " << (distribution == Host ? "host" : "round-robin") << endl;
+
+			}
+		}
+
 		send_delay = Object::getAttribute(node, "sqlite", "retry-delay", (unsigned int) send_delay);
 
+		{
+			unsigned int timeout = Object::getAttribute(node, "sqlite", "query-timeout", (unsigned int) 0);
+			timeouts.select = Object::getAttribute(node, "sqlite", "select-timeout", timeout);
+			timeouts.pending = Object::getAttribute(node, "sqlite", "pending-timeout", timeout);
+			timeouts.report = Object::getAttribute(node, "sqlite", "report-timeout", timeout);
+			timeouts.coalesce = Object::getAttribute(node, "sqlite", "coalesce-timeout", timeout);
+			timeouts.next = Object::getAttribute(node, "sqlite", "next-timeout", timeout);
+		}
+		backoff = Object::getAttribute(node, "sqlite", "backoff", (unsigned int) backoff);
+
+		if(node.attribute("blob-table")) {
+			blob.table = Quark(node,"blob-table","",false).c_str();
+			blob.column = Quark(node,"blob-column","payload",false).c_str();
+		}
+
+		schedule.next = child_value(node,"next",false);
+		schedule.defer = child_value(node,"defer",false);
+		schedule.delay = Object::getAttribute(node, "sqlite", "schedule-delay", (unsigned int) schedule.delay);
+		schedule.retry = Object::getAttribute(node, "sqlite", "retry-after", (unsigned int) schedule.retry);
+
+		ndjson.sql = child_value(node,"export",false);
+		if(node.attribute("ndjson-file")) {
+			ndjson.filename = Quark(node,"ndjson-file","",false).c_str();
+		}
+
+		deadletter.fail = child_value(node,"fail",false);
+		deadletter.sql = child_value(node,"dead-letter",false);
+		deadletter.attempts = Object::getAttribute(node, "sqlite", "max-attempts", (unsigned int) deadletter.attempts);
+
+		lease.claim = child_value(node,"claim",false);
+		if(*lease.claim) {
+
+			lease.release = child_value(node,"release",false);
+			lease.time = Object::getAttribute(node, "sqlite", "lease-time", (unsigned int) lease.time);
+
+			// Owner id, unique for each process.
+			lease.owner = node.attribute("owner").as_string();
+			if(lease.owner.empty()) {
+				std::random_device random;
+				char buffer[40];
+				snprintf(buffer,sizeof(buffer),"%08x%08x-%lx",random(),random(),(unsigned long) time(0));
+				lease.owner = buffer;
+			}
+
+			info() << "Leasing requests as '" << lease.owner << "' for " << lease.time << " seconds" << endl;
+
+		}
+
+		//
+		// Create default states.
+		//
+		{
+			const char * name = Protocol::c_str();
+
+			states.none = make_shared<Abstract::State>("none", Level::unimportant, _( "No pending requests") );
+
+			states.empty = make_shared<StringState>(
+								"empty",
+								Level::unimportant,
+								Message{ _("{} output queue is empty"), name }
+							);
+
+			states.one = make_shared<StringState>(
+								"pending",
+								Level::warning,
+								Message{ _("One pending request in the {} queue"), name }
+							);
+
+			states.many = make_shared<StringState>(
+								"pending",
+								Level::warning,
+								Message{ _("{} pending requests in the {} queue"), "", name }
+							);
+		}
+
+		{
+			const char *envelope = node.attribute("coalesce").as_string("none");
+			if(!strcasecmp(envelope,"json")) {
+				coalesce.envelope = JsonArray;
+			} else if(!strcasecmp(envelope,"ndjson") || !strcasecmp(envelope,"lines")) {
+				coalesce.envelope = Lines;
+			} else if(strcasecmp(envelope,"none")) {
+				throw runtime_error(Logger::String("Unexpected coalesce mode '",envelope,"'"));
+			}
+
+			if(coalesce.envelope != None && *lease.claim) {
+				warning() << "Coalescing is not available with leased requests, disabling it" << endl;
+				coalesce.envelope = None;
+			}
+
+			if(coalesce.envelope != None) {
+				coalesce.sql = child_value(node,"coalesce");
+				coalesce.count = Object::getAttribute(node, "sqlite", "coalesce-max-count", (unsigned int) coalesce.count);
+				coalesce.bytes = Object::getAttribute(node, "sqlite", "coalesce-max-bytes", (unsigned int) coalesce.bytes);
+			}
+		}
+
+		connections.max = Object::getAttribute(node, "sqlite", "max-connections-per-host", (unsigned int) connections.max);
+		connections.idle = Object::getAttribute(node, "sqlite", "connection-idle-timeout", (unsigned int) connections.idle);
+
 		for(pugi::xml_node child = node.child("init"); child; child = child.next_sibling("init")) {
 
 			String sql{child.child_value()};
@@ -89,18 +256,139 @@
 
 			debug(sql.c_str());
 
-			database->exec(sql.c_str());
+			for(auto &shard : shards) {
+				shard->database->exec(sql.c_str());
+			}
+
+		}
+
+		//
+		// Check query plans.
+		//
+		{
+			const char *mode = node.attribute("query-plan").as_string("warn");
+			if(strcasecmp(mode,"ignore")) {
+
+				bool autoindex = node.attribute("auto-index").as_bool(false);
+
+				const struct {
+					const char *name;
+					const char *sql;
+				} queries[] = {
+					{ "select",		select		},
+					{ "claim",		lease.claim	},
+					{ "delete",		del			},
+					{ "pending",	pending		},
+					{ "report",		list		},
+					{ "coalesce",	coalesce.sql	},
+					{ "next",		schedule.next	},
+					{ "fail",		deadletter.fail	},
+					{ "dead-letter",	deadletter.sql	},
+					{ "export",		ndjson.sql	},
+				};
+
+				bool valid = true;
+				for(auto &query : queries) {
+					if(!explain(query.name,query.sql,autoindex)) {
+						valid = false;
+					}
+				}
+
+				if(!valid && !strcasecmp(mode,"fail")) {
+					throw runtime_error("Queue queries would require full table scans or temporary b-trees");
+				}
 
+			}
+		}
+
+		size_t buffer = Object::getAttribute(node, "sqlite", "buffer-size", (unsigned int) 0);
+		if(buffer) {
+			size_t batch = Object::getAttribute(node, "sqlite", "buffer-batch", (unsigned int) 100);
+			for(auto &shard : shards) {
+				Shard *target = shard.get();
+				shard->ingest.reset(
+					new Ingest(
+						shard->database,
+						buffer,
+						batch,
+						[this](std::shared_ptr<Database> database, Statement &stmt, const Ingest::Record &record) {
+							return store(database,stmt,record);
+						},
+						[this,target](size_t stored) {
+							if(stored) {
+								enqueued(*target,stored);
+								refresh();
+							}
+						}
+					)
+				);
+			}
 		}
 
 	}
 
 	SQLite::Protocol::~Protocol() {
-		if(busy) {
-			info() << "Waiting for workers" << endl;
-			ThreadPool::getInstance().wait();
+
+		// Senders (agents and the module scheduler) hold a reference while sending,
+		// so there's no active send here, only the buffers to store.
+		stop(chrono::steady_clock::now() + chrono::seconds(10));
+
+		info() << "Disabling protocol handler" << endl;
+	}
+
+	bool SQLite::Protocol::stop(const std::chrono::steady_clock::time_point &deadline) noexcept {
+
+		{
+			lock_guard<mutex> lock(sender.guard);
+			if(sender.stopped) {
+				return !sender.busy;
+			}
+			sender.stopped = true;
+		}
+
+		auto begin = chrono::steady_clock::now();
+
+		// Store buffered requests until the deadline, new ones are inserted directly.
+		for(auto &shard : shards) {
+			if(shard->ingest) {
+				size_t count = shard->ingest->size();
+				size_t discarded = shard->ingest->stop(deadline);
+				if(count > discarded) {
+					info() << "Stored " << (count - discarded) << " buffered request(s)" << endl;
+				}
+			}
+		}
+
+		bool finished = true;
+		{
+			unique_lock<mutex> lock(sender.guard);
+			if(sender.busy) {
+
+				info() << "Waiting for active send" << endl;
+
+				if(!sender.idle.wait_until(lock,deadline,[this]{ return !sender.busy; })) {
+
+					// Abort this queue's statements, the connection is shared with other queues and
+					// the recorder. The request is removed only after a successful send, so it stays
+					// on the queue (leased ones are released when the lease expires).
+					warning() << "Shutdown deadline reached, cancelling active send" << endl;
+					cancellation->cancel();
+					finished = false;
+
+				}
+
+			}
 		}
-		info() << "Disabling " << (busy ? "an active" : "inactive") << " protocol handler" << endl;
+
+		auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+		if(finished) {
+			info() << "Queue stopped in " << elapsed << "ms" << endl;
+		} else {
+			warning() << "Queue stopped in " << elapsed << "ms with an interrupted send" << endl;
+		}
+
+		return finished;
+
 	}
 
 	void SQLite::Protocol::insert(Abstract::Agent *listener) {
@@ -114,7 +402,11 @@
 	}
 
 	void SQLite::Protocol::refresh() {
-		time_t delay = (busy ? 60 : 0);
+		time_t delay;
+		{
+			lock_guard<mutex> lock(sender.guard);
+			delay = (sender.busy ? 60 : 0);
+		}
 
 		lock_guard<mutex> lock(guard);
 		for(auto listener : listeners) {
@@ -125,129 +417,199 @@
 
 	std::shared_ptr<Abstract::State> SQLite::Protocol::state() const {
 
-		if(pending && *pending) {
-
-			/// @brief Message based state.
-			class StringState : public Abstract::State {
-			private:
-				std::string message;
-
-			public:
-				StringState(const char *name, Level level, const std::string &msg) : Abstract::State(name,level), message{msg} {
-					Object::properties.summary = message.c_str();
-				}
-			};
-
-			//
-			// Create default states.
-			//
-			std::shared_ptr<Abstract::State> state;
-
-			auto value = count();
-			const char * name = Protocol::c_str();
-
-			if(!value) {
-
-				state = make_shared<StringState>(
-								"empty",
-								Level::unimportant,
-								Message{ _("{} output queue is empty"), name }
-							);
+		if(!(pending && *pending)) {
+			return states.none;
+		}
 
-			} else if(value == 1) {
+		int64_t value = size();
 
-				state = make_shared<StringState>(
-								"pending",
-								Level::warning,
-								Message{ _("One pending request in the {} queue"), name }
-							);
+		if(!value) {
+			return states.empty;
+		}
 
-			} else {
+		if(value == 1) {
+			return states.one;
+		}
 
-				state = make_shared<StringState>(
+		lock_guard<mutex> lock(states.guard);
+		if(value != states.value) {
+			// Queue size has changed, replace the state; the old one lives while someone holds it.
+			states.value = value;
+			states.many = make_shared<StringState>(
 								"pending",
 								Level::warning,
-								Message{ _("{} pending requests in the {} queue"), value, name }
+								Message{ _("{} pending requests in the {} queue"), value, Protocol::c_str() }
 							);
+		}
 
-			}
+		return states.many;
+	}
 
-			info() << state->summary() << endl;
+	void SQLite::Protocol::deliver(HTTP::Method method, const Udjat::URL &url, const std::string &payload) {
 
-			return state;
+		connections.cleanup();
+		auto client = connections.get(url.c_str());
 
+		if(method == HTTP::Post) {
+			auto response = client->post(payload.c_str());
+			Logger::write(Logger::Trace,response);
+		} else {
+			auto response = client->get();
+			info() << url << endl;
+			Logger::write(Logger::Trace,response);
 		}
 
-		return make_shared<Abstract::State>("none", Level::unimportant, _( "No pending requests") );
 	}
 
 	bool SQLite::Protocol::send() noexcept {
+		size_t bytes;
+		return send(bytes);
+	}
+
+	bool SQLite::Protocol::send(size_t &bytes) noexcept {
 
 		size_t success = false;
+		bytes = 0;
 
 		debug("start ", __FUNCTION__);
 
-		static mutex guard;
-
 		{
-			lock_guard<mutex> lock(guard);
-			if(busy) {
+			lock_guard<mutex> lock(sender.guard);
+			if(sender.stopped) {
+				debug("Queue is stopped");
+				return 0;
+			}
+			if(sender.busy) {
 				debug("Worker is busy");
 				return 0;
 			}
-			busy = true;
+			sender.busy = true;
 		}
 
 		try {
 
-			Statement del(database,this->del);
-			Statement select(database,this->select);
+			// Checked before the select, a leased request can't be claimed and then abandoned.
 			MainLoop &mainloop = MainLoop::getInstance();
 
-			if(select.step() == SQLITE_ROW && mainloop && Protocol::verify(this)) {
+			// Check the shards in turn, starting after the last one used.
+			for(size_t ix = 0; mainloop && Protocol::verify(this) && ix < shards.size(); ix++) {
+
+				Shard &shard = *shards[(next + ix) % shards.size()];
+				Statement select(shard.database,(*lease.claim ? lease.claim : this->select));
+				select.timeout(timeouts.select).cancellable(cancellation);
+
+				if(*lease.claim) {
+					select.bind(1,lease.owner.c_str());
+					select.bind(2,(int64_t) lease.time);
+				}
+
+				if(select.step() != SQLITE_ROW) {
+					continue;
+				}
+
+				next = (next + ix + 1) % shards.size();
 
 				int64_t id;
 				Udjat::URL url;
 				string action, payload;
+				unsigned int attempts = 0;
 
-				select.get(0,id);
-				select.get(1,url);
-				select.get(2,action);
-				select.get(3,payload);
+				if(blob.table) {
+					std::tie(id,url,action) = select.row<int64_t,Udjat::URL,string>();
+				} else {
+					std::tie(id,url,action,payload) = select.row<int64_t,Udjat::URL,string,string>();
+				}
+
+				// Optional column: ATTEMPTS
+				{
+					int column = (blob.table ? 3 : 4);
+					if(select.columns() > column) {
+						int64_t value = 0;
+						select.get(column,value);
+						attempts = (unsigned int) value;
+					}
+				}
+				select.reset();
 
-				info() << "Sending " << action << " " << url << " (" << id << ")" << endl;
+				if(blob.table) {
+					// Read payload in chunks, allocating it only once; the HTTP client takes the
+					// whole body, so it's still held in memory (the same single copy as a text column).
+					Blob{shard.database,blob.table,blob.column,id}.get(payload);
+				}
+
+				std::vector<int64_t> ids{id};
+				HTTP::Method method = HTTP::MethodFactory(action.c_str());
+
+				if(method == HTTP::Post && coalesce.envelope != None) {
+					payload = group(shard,url.c_str(),action.c_str(),ids,payload);
+				}
+
+				if(ids.size() > 1) {
+					info() << "Sending " << action << " " << url << " (" << ids.size() << " coalesced requests)" << endl;
+				} else {
+					info() << "Sending " << action << " " << url << " (" << id << ")" << endl;
+				}
 				Logger::write(Logger::Trace,Protocol::c_str(),payload.c_str());
 
-				HTTP::Client client(url);
+				bytes = url.size() + payload.size();
 
-				switch(HTTP::MethodFactory(action.c_str())) {
-				case HTTP::Get:
-					{
-						auto response = client.get();
-						info() << url << endl;
-						Logger::write(Logger::Trace,response);
-						success = true;
-					}
-					break;
+				Outcome result = Success;
+				string reason;
+
+				try {
+
+					switch(method) {
+					case HTTP::Get:
+					case HTTP::Post:
+						deliver(method,url,payload);
+						break;
 
-				case HTTP::Post:
-					{
-						auto response = client.post(payload.c_str());
-						Logger::write(Logger::Trace,response);
-						success = true;
+					default:
+						error() << "Unexpected verb '" << action << "' sending queued request" << endl;
+						result = Permanent;
+						reason = "Unexpected verb '" + action + "'";
 					}
-					break;
 
-				default:
-					error() << "Unexpected verb '" << action << "' sending queued request, ignoring" << endl;
-					success = false;
+				} catch(const HTTP::Exception &e) {
+
+					// Don't reuse a client after a failure.
+					connections.remove(url.c_str());
+					result = outcome(e.code());
+					reason = e.what();
+
+				} catch(const std::exception &e) {
+
+					connections.remove(url.c_str());
+					result = Retryable;
+					reason = e.what();
+
 				}
 
-				info() << "Removing request '" << id << "' from URL queue" << endl;
-				del.bind(1,id).exec();
+				if(result == Success || (method != HTTP::Get && method != HTTP::Post && !*deadletter.sql)) {
 
-				del.reset();
-				select.reset();
+					// Sent (or unsupported verb without dead-letter table), remove it from queue.
+					suspend(url.c_str(),0);
+					remove(shard,ids);
+					success = (result == Success);
+
+				} else if(failed(shard,ids,attempts,result,reason.c_str())) {
+
+					// Moved to dead-letter, let the rest of the queue drain.
+					success = true;
+
+				} else {
+
+					// All the coalesced requests failed, not only the first one.
+					release(shard,ids);
+					defer(shard,ids);
+					if(result == Retryable) {
+						suspend(url.c_str(),backoff);
+					}
+					throw runtime_error(reason);
+
+				}
+
+				break;
 
 			}
 
@@ -264,15 +626,346 @@
 		}
 
 		{
-			lock_guard<mutex> lock(guard);
-			busy = false;
+			lock_guard<mutex> lock(sender.guard);
+			sender.busy = false;
 		}
+		sender.idle.notify_all();
 
 		debug(__FUNCTION__," complete (", (success ? "Message sent" : "Message NOT sent"), ")");
 
 		return success;
 	}
 
+	std::string SQLite::Protocol::group(Shard &shard, const char *url, const char *action, std::vector<int64_t> &ids, const std::string &payload) {
+
+		string response;
+		size_t length = payload.size();
+
+		if(coalesce.envelope == JsonArray) {
+			response = "[";
+		}
+		response += payload;
+
+		Statement stmt(shard.database,coalesce.sql);
+		stmt.timeout(timeouts.coalesce).cancellable(cancellation);
+		stmt.bind(url,action,nullptr);
+
+		for(auto [id, value] : stmt.rows<int64_t,std::string_view>()) {
+
+			if(id == ids[0]) {
+				continue;
+			}
+
+			if(ids.size() >= coalesce.count || (length + value.size() + 1) > coalesce.bytes) {
+				break;
+			}
+
+			response += (coalesce.envelope == JsonArray ? "," : "\n");
+			response += value;
+			length += value.size() + 1;
+			ids.push_back(id);
+
+		}
+
+		if(coalesce.envelope == JsonArray) {
+			response += "]";
+		} else {
+			response += "\n";
+		}
+
+		return response;
+
+	}
+
+	SQLite::Protocol::Outcome SQLite::Protocol::outcome(unsigned int code) noexcept {
+
+		if(code >= 200 && code < 300) {
+			return Success;
+		}
+
+		// Timeout, too early, too many requests and server errors can succeed later.
+		if(code == 408 || code == 425 || code == 429) {
+			return Retryable;
+		}
+
+		if(code >= 400 && code < 500) {
+			return Permanent;
+		}
+
+		// No status (network failure), redirects and server errors.
+		return Retryable;
+
+	}
+
+	bool SQLite::Protocol::failed(Shard &shard, const std::vector<int64_t> &ids, unsigned int attempts, Outcome outcome, const char *reason) noexcept {
+
+		attempts++;
+
+		try {
+
+			if(*deadletter.sql && (outcome == Permanent || (deadletter.attempts && attempts >= deadletter.attempts))) {
+
+				if(outcome == Permanent) {
+					error() << "Moving request '" << ids[0] << "' to dead-letter: " << reason << endl;
+				} else {
+					error() << "Moving request '" << ids[0] << "' to dead-letter after " << attempts << " attempts: " << reason << endl;
+				}
+
+				bury(shard,ids,reason);
+				return true;
+
+			}
+
+			if(*deadletter.fail) {
+
+				Statement stmt(shard.database,deadletter.fail);
+				for(auto id : ids) {
+					stmt.bind(1,id).exec();
+					stmt.reset();
+				}
+
+			}
+
+		} catch(const std::exception &e) {
+
+			warning() << "Error updating failed request '" << ids[0] << "': " << e.what() << endl;
+
+		}
+
+		return false;
+
+	}
+
+	void SQLite::Protocol::bury(Shard &shard, const std::vector<int64_t> &ids, const char *reason) {
+
+		Statement dead(shard.database,deadletter.sql);
+		Statement del(shard.database,this->del);
+
+		// Leased requests are deleted by id and owner.
+		if(*lease.claim && del.parameters() > 1) {
+			del.bind(2,lease.owner.c_str());
+		}
+
+		// Optional argument: REASON
+		bool explained = (dead.parameters() > 1);
+		size_t removed = 0;
+
+		Transaction transaction{shard.database};
+		for(auto id : ids) {
+			dead.bind(1,id);
+			if(explained) {
+				dead.bind(2,reason);
+			}
+			dead.exec();
+			dead.reset();
+
+			removed += del.bind(1,id).update();
+			del.reset();
+		}
+		transaction.commit();
+		dequeued(shard,removed);
+
+		if(removed < ids.size()) {
+			warning() << "Lease lost on " << (ids.size() - removed) << " request(s), not removed from queue" << endl;
+		}
+
+	}
+
+	void SQLite::Protocol::release(Shard &shard, const std::vector<int64_t> &ids) noexcept {
+
+		if(!(lease.release && *lease.release)) {
+			return;
+		}
+
+		try {
+
+			Statement stmt(shard.database,lease.release);
+			stmt.bind(2,lease.owner.c_str());
+
+			Transaction transaction{shard.database};
+			for(auto id : ids) {
+				stmt.bind(1,id).exec();
+				stmt.reset();
+			}
+			transaction.commit();
+
+		} catch(const std::exception &e) {
+
+			warning() << "Error releasing request '" << ids[0] << "': " << e.what() << endl;
+
+		}
+
+	}
+
+	void SQLite::Protocol::defer(Shard &shard, const std::vector<int64_t> &ids) noexcept {
+
+		if(!(schedule.defer && *schedule.defer)) {
+			return;
+		}
+
+		try {
+
+			Statement stmt(shard.database,schedule.defer);
+			stmt.bind(1,(int64_t) (time(0) + schedule.retry));
+
+			Transaction transaction{shard.database};
+			for(auto id : ids) {
+				stmt.bind(2,id).exec();
+				stmt.reset();
+			}
+			transaction.commit();
+
+		} catch(const std::exception &e) {
+
+			warning() << "Error deferring request '" << ids[0] << "': " << e.what() << endl;
+
+		}
+
+	}
+
+	time_t SQLite::Protocol::due() const {
+
+		int64_t value = 0;
+		if(scheduled()) {
+			for(auto &shard : shards) {
+				Statement stmt{shard->database,schedule.next};
+				stmt.timeout(timeouts.next).cancellable(cancellation);
+				if(stmt.step() == SQLITE_ROW) {
+					int64_t due;
+					std::tie(due) = stmt.row<int64_t>();
+					if(due && (!value || due < value)) {
+						value = due;
+					}
+				}
+			}
+		}
+		return (time_t) value;
+
+	}
+
+	void SQLite::Protocol::remove(Shard &shard, const std::vector<int64_t> &ids) {
+
+		Statement del(shard.database,this->del);
+
+		// Leased requests are deleted by id and owner.
+		if(*lease.claim && del.parameters() > 1) {
+			del.bind(2,lease.owner.c_str());
+		}
+
+		size_t removed = 0;
+
+		if(ids.size() == 1) {
+			info() << "Removing request '" << ids[0] << "' from URL queue" << endl;
+			removed = del.bind(1,ids[0]).update();
+		} else {
+			info() << "Removing " << ids.size() << " coalesced requests from URL queue" << endl;
+			Transaction transaction{shard.database};
+			for(auto id : ids) {
+				removed += del.bind(1,id).update();
+				del.reset();
+			}
+			transaction.commit();
+		}
+
+		// A request leased by other sender after our lease expired isn't deleted, it will be sent again.
+		if(removed < ids.size()) {
+			warning() << "Lease lost on " << (ids.size() - removed) << " request(s), not removed from queue" << endl;
+		}
+
+		dequeued(shard,removed);
+
+	}
+
+	bool SQLite::Protocol::store(std::shared_ptr<Database> database, Statement &stmt, const Ingest::Record &record) const {
+
+		// Optional argument: KEY (named), hash of url, verb and payload.
+		int key = stmt.parameter(":key");
+		if(key) {
+			uint64_t value = hash(record.url.data(),record.url.size());
+			value = hash("",1,value);
+			value = hash(record.verb.data(),record.verb.size(),value);
+			value = hash("",1,value);
+			value = hash(record.payload.data(),record.payload.size(),value);
+			stmt.bind(key,(int64_t) value);
+		}
+
+		// Optional argument: NOT_BEFORE
+		if(stmt.parameters() > 3 && key != 4) {
+			stmt.bind(4,(int64_t) (record.not_before ? record.not_before : time(0)));
+		}
+
+		int64_t rowid;
+
+		if(blob.table) {
+
+			// Insert an empty blob and write the payload on it, in chunks, without extra copies.
+			stmt.bind(1,record.url.c_str());
+			stmt.bind(2,record.verb.c_str());
+			stmt.zeroblob(3,record.payload.size());
+
+			rowid = stmt.insert();
+			if(rowid) {
+				Blob{database,blob.table,blob.column,rowid,true}.set(record.payload.data(),record.payload.size());
+			}
+
+		} else {
+
+			// Arguments: URL, VERB, Payload
+			stmt.bind(
+				record.url.c_str(),
+				record.verb.c_str(),
+				record.payload.c_str(),
+				nullptr
+			);
+
+			rowid = stmt.insert();
+
+		}
+
+		// Counted on every insert, the key can also be an expression ('json_extract(?3,...)').
+		dedup.received++;
+		if(!rowid) {
+			// Already queued ('ON CONFLICT DO NOTHING').
+			dedup.duplicates++;
+		}
+
+		return rowid != 0;
+
+	}
+
+	void SQLite::Protocol::enqueued(Shard &shard, size_t count) noexcept {
+		int64_t value = shard.queued.load();
+		while(value >= 0 && !shard.queued.compare_exchange_weak(value,value + (int64_t) count));
+	}
+
+	void SQLite::Protocol::dequeued(Shard &shard, size_t count) noexcept {
+		int64_t value = shard.queued.load();
+		while(value >= 0 && !shard.queued.compare_exchange_weak(value,std::max((int64_t) 0, value - (int64_t) count)));
+	}
+
+	SQLite::Protocol::Shard & SQLite::Protocol::shard(const char *url) const {
+
+		if(shards.size() == 1) {
+			return *shards[0];
+		}
+
+		if(distribution == RoundRobin) {
+			return *shards[cursor++ % shards.size()];
+		}
+
+		// Requests to the same host are kept on the same shard.
+		string host{SQLite::Endpoint{url}.host};
+		return *shards[hash(host.data(),host.size()) % shards.size()];
+
+	}
+
+	void SQLite::Protocol::suspend(const char *url, time_t seconds) noexcept {
+		string host{SQLite::Endpoint{url}.host};
+		for(auto &shard : shards) {
+			shard->database->backoff(host.c_str(),seconds);
+		}
+	}
+
 	std::shared_ptr<Protocol::Worker> SQLite::Protocol::WorkerFactory() const {
 
 		class Worker : public Udjat::Protocol::Worker {
@@ -295,24 +988,39 @@
 				String sql{this->sql};
 				sql.expand(true,true);
 
-				// Prepare.
-				Statement stmt(protocol->database,sql.c_str());
-
 				// Arguments: URL, VERB, Payload
-				stmt.bind(
-					url().c_str(),
-					std::to_string(method()),
-					payload(),
-					nullptr
-				);
+				Ingest::Record record{sql,url(),std::to_string(method()),payload()};
+				if(protocol->schedule.delay) {
+					record.not_before = time(0) + protocol->schedule.delay;
+				}
 
-				stmt.exec();
+				Protocol *prot = const_cast<Protocol *>(this->protocol);
+				Shard &shard = protocol->shard(record.url.c_str());
 
-				{
-					Protocol *prot = const_cast<Protocol *>(this->protocol);
-					if(prot) {
-						prot->refresh();
+				// Enqueue, if the buffer is full insert it here.
+				if(!(shard.ingest && shard.ingest->push(std::move(record)))) {
+
+					if(shard.ingest) {
+						debug("Ingest buffer is full, inserting request directly");
+					}
+
+					Statement stmt(shard.database,record.sql.c_str());
+
+					bool stored;
+					if(protocol->blob.table) {
+						// Don't keep a row without payload if the blob write fails.
+						Transaction transaction{shard.database};
+						stored = protocol->store(shard.database,stmt,record);
+						transaction.commit();
+					} else {
+						stored = protocol->store(shard.database,stmt,record);
+					}
+
+					if(stored) {
+						prot->enqueued(shard,1);
 					}
+					prot->refresh();
+
 				}
 
 				// Force as complete.
@@ -327,7 +1035,97 @@
 
 	bool SQLite::Protocol::get(const char *path, Report &report) {
 
-		throw system_error(ENOTSUP,system_category(),_( "Not implemented" ));
+		if(*path == '/') {
+			path++;
+		}
+
+		if(!strcasecmp(path,"connections")) {
+			connections.get(report);
+			return true;
+		}
+
+		if(!strcasecmp(path,"queue") && list && *list) {
+
+			// Values are ID,URL,ACTION
+			report.start("id","url","action",nullptr);
+			for(auto &shard : shards) {
+				Statement stmt{shard->database,list};
+				stmt.timeout(timeouts.report).cancellable(cancellation);
+				for(auto [id, url, action] : stmt.rows<int64_t,std::string_view,std::string_view>()) {
+					report << id << string{url} << string{action};
+				}
+			}
+
+			return true;
+		}
+
+		if(ndjson.filename && (!strcasecmp(path,"export") || !strcasecmp(path,"import"))) {
+
+			// Status only, reading a report doesn't export or import.
+			struct stat st;
+			report.start("file","bytes","imported-lines",nullptr);
+			report << ndjson.filename << (int64_t) (stat(ndjson.filename,&st) ? -1 : st.st_size) << (int64_t) imported(ndjson.filename);
+			return true;
+		}
+
+		if(ndjson.filename && (!strcasecmp(path,"export/run") || !strcasecmp(path,"import/run"))) {
+
+			unique_lock<mutex> lock(ndjson.guard,try_to_lock);
+			if(!lock) {
+				throw runtime_error("An export or import is already running");
+			}
+
+			auto begin = chrono::steady_clock::now();
+			size_t count;
+
+			if(strncasecmp(path,"export",6)) {
+
+				// Renamed only when complete, a failed import is resumed by the next one.
+				count = load(ndjson.filename);
+
+				string filename{ndjson.filename};
+				filename += ".imported";
+				if(rename(ndjson.filename,filename.c_str())) {
+					throw runtime_error(Logger::String("Can't rename '",ndjson.filename,"': ",strerror(errno)));
+				}
+
+			} else {
+
+				if(imported(ndjson.filename)) {
+					throw runtime_error(Logger::String("'",ndjson.filename,"' has an incomplete import, run it again before exporting"));
+				}
+				count = dump(ndjson.filename);
+
+			}
+
+			report.start("file","requests","time",nullptr);
+			report << ndjson.filename << (int64_t) count << (int64_t) chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+			return true;
+		}
+
+		if(!strcasecmp(path,"dedup")) {
+			size_t received = dedup.received.load();
+			size_t duplicates = dedup.duplicates.load();
+			report.start("received","duplicates","ratio",nullptr);
+			report << (int64_t) received << (int64_t) duplicates << (received ? ((double) duplicates) / received : 0.0);
+			return true;
+		}
+
+		if(!strcasecmp(path,"shards")) {
+			report.start("shard","database","queued",nullptr);
+			for(size_t ix = 0; ix < shards.size(); ix++) {
+				int64_t value = shards[ix]->queued.load();
+				report << (int64_t) ix << shards[ix]->database->name() << (value < 0 ? count(*shards[ix]) : value);
+			}
+			return true;
+		}
+
+		if(!strcasecmp(path,"statements")) {
+			database->profile(report);
+			return true;
+		}
+
+		return false;
 
 	}
 
@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/protocol.h>
+ #include <udjat/tools/logger.h>
+ #include <string>
+ #include <cstring>
+ #include <cctype>
+ #include <vector>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Get lower case copy of sql.
+	static string lowercase(const char *sql) {
+		string lower{sql};
+		for(auto &chr : lower) {
+			chr = tolower(chr);
+		}
+		return lower;
+	}
+
+	static bool isword(char chr) {
+		return isalnum((unsigned char) chr) || chr == '_';
+	}
+
+	/// @brief Find keyword on a lower case sql, on word boundaries; its words can be separated by any whitespace.
+	/// @param keyword The lower case keyword, words separated by a single space ("order by").
+	/// @return The offset after the keyword, string::npos if not found.
+	static size_t find(const string &sql, const char *keyword) {
+
+		for(size_t pos = 0; pos < sql.size(); pos++) {
+
+			if(pos && isword(sql[pos-1])) {
+				continue;
+			}
+
+			size_t ptr = pos;
+			const char *key = keyword;
+			while(*key && ptr < sql.size()) {
+				if(*key == ' ') {
+					if(!isspace(sql[ptr])) {
+						break;
+					}
+					while(ptr < sql.size() && isspace(sql[ptr])) {
+						ptr++;
+					}
+					key++;
+				} else if(*key == sql[ptr]) {
+					key++;
+					ptr++;
+				} else {
+					break;
+				}
+			}
+
+			if(!*key && (ptr == sql.size() || !isword(sql[ptr]))) {
+				return ptr;
+			}
+
+		}
+
+		return string::npos;
+
+	}
+
+	/// @brief Get identifier after keyword (case insensitive) on sql, empty if not found or not a plain column.
+	static string identifier(const char *sql, const char *keyword) {
+
+		auto pos = find(lowercase(sql),keyword);
+		if(pos == string::npos) {
+			return "";
+		}
+
+		const char *ptr = sql + pos;
+		while(*ptr && isspace(*ptr)) {
+			ptr++;
+		}
+
+		const char *from = ptr;
+		while(*ptr && (isalnum(*ptr) || *ptr == '_')) {
+			ptr++;
+		}
+
+		string name{from,(size_t) (ptr-from)};
+
+		while(*ptr && isspace(*ptr)) {
+			ptr++;
+		}
+
+		if(*ptr == '(' || *ptr == '.') {
+			// It's an expression, can't recommend an index.
+			return "";
+		}
+
+		return name;
+
+	}
+
+	/// @brief Get table name from a query plan 'SCAN' detail.
+	static string table(const char *detail) {
+
+		const char *ptr = strstr(detail,"SCAN ");
+		if(!ptr) {
+			return "";
+		}
+		ptr += 5;
+
+		if(!strncmp(ptr,"TABLE ",6)) {
+			ptr += 6;
+		}
+
+		const char *from = ptr;
+		while(*ptr && (isalnum(*ptr) || *ptr == '_')) {
+			ptr++;
+		}
+
+		return string{from,(size_t) (ptr-from)};
+
+	}
+
+	bool SQLite::Protocol::explain(const char *name, const char *sql, bool autoindex) {
+
+		if(!(sql && *sql)) {
+			return true;
+		}
+
+		std::vector<string> problems;
+		string index;
+
+		{
+			string where{identifier(sql,"where")};
+			string order{identifier(sql,"order by")};
+
+			Statement stmt{database,(string{"EXPLAIN QUERY PLAN "} + sql).c_str()};
+			while(stmt.step() == SQLITE_ROW) {
+
+				string detail;
+				stmt.get(3,detail);
+
+				if(!strncmp(detail.c_str(),"SCAN ",5) && !strstr(detail.c_str()," USING ")) {
+
+					// Full scan, only a problem when filtering rows.
+					if(find(lowercase(sql),"where") != string::npos) {
+						problems.push_back(detail);
+						if(!where.empty()) {
+							string tbl{table(detail.c_str())};
+							index = string{"create index if not exists "} + tbl + "_" + where + " on " + tbl + " (" + where + ")";
+						}
+					}
+
+				} else if(strstr(detail.c_str(),"USE TEMP B-TREE")) {
+
+					problems.push_back(detail);
+					if(index.empty() && !order.empty() && strstr(detail.c_str(),"ORDER BY")) {
+						// Get table from the main scan.
+						string tbl{identifier(sql,"from")};
+						if(!tbl.empty()) {
+							index = string{"create index if not exists "} + tbl + "_" + order + " on " + tbl + " (" + order + ")";
+						}
+					}
+
+				}
+
+			}
+		}
+
+		if(problems.empty()) {
+			return true;
+		}
+
+		for(auto &problem : problems) {
+			warning() << "The '" << name << "' query plan has '" << problem << "'" << endl;
+		}
+
+		if(index.empty()) {
+			return false;
+		}
+
+		if(!autoindex) {
+			warning() << "Recommended index for '" << name << "': " << index << endl;
+			return false;
+		}
+
+		info() << "Creating index for '" << name << "': " << index << endl;
+		for(auto &shard : shards) {
+			shard->database->exec(index.c_str());
+		}
+
+		return explain(name,sql,false);
+
+	}
+
+ }
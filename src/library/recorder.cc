@@ -0,0 +1,218 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <pugixml.hpp>
+ #include <udjat/defs.h>
+ #include <udjat/tools/object.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <udjat/sqlite/recorder.h>
+ #include <iostream>
+ #include <chrono>
+ #include <ctime>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Recorder::Recorder(std::shared_ptr<Database> db, const pugi::xml_node &node) : database{db}, table{node.attribute("table").as_string("samples")} {
+
+		batch = Object::getAttribute(node, "sqlite", "batch", (unsigned int) batch);
+		interval = Object::getAttribute(node, "sqlite", "flush-interval", (unsigned int) interval);
+		downsample = Object::getAttribute(node, "sqlite", "downsample-interval", (unsigned int) downsample);
+		retention.samples = Object::getAttribute(node, "sqlite", "keep-samples", (unsigned int) retention.samples);
+		retention.minutes = Object::getAttribute(node, "sqlite", "keep-minutes", (unsigned int) retention.minutes);
+		retention.hours = Object::getAttribute(node, "sqlite", "keep-hours", (unsigned int) retention.hours);
+
+		if(!interval) {
+			interval = 1;
+		}
+
+		// Clustered on (agent,timestamp), no rowid.
+		database->exec(
+			(
+				string{"create table if not exists "} + table
+					+ " (agent text not null, timestamp integer not null, value real,"
+					" primary key(agent,timestamp)) without rowid;"
+				"create index if not exists " + table + "_timestamp on " + table + " (timestamp);"
+			).c_str()
+		);
+
+		for(const char *suffix : { "_minute", "_hour" }) {
+			database->exec(
+				(
+					string{"create table if not exists "} + table + suffix
+						+ " (agent text not null, timestamp integer not null,"
+						" min real, max real, avg real, count integer,"
+						" primary key(agent,timestamp)) without rowid;"
+					"create index if not exists " + table + suffix + "_timestamp on " + table + suffix + " (timestamp);"
+				).c_str()
+			);
+		}
+
+		thread = std::thread([this](){
+
+			time_t next = time(0) + downsample;
+
+			unique_lock<mutex> lock(guard);
+			while(enabled) {
+
+				wakeup.wait_for(lock,chrono::seconds(interval));
+
+				lock.unlock();
+				try {
+
+					flush();
+
+					if(time(0) >= next) {
+						rollup();
+						next = time(0) + downsample;
+					}
+
+				} catch(const std::exception &e) {
+
+					cerr << "sqlite\tError updating '" << table << "': " << e.what() << endl;
+
+				}
+				lock.lock();
+
+			}
+
+		});
+
+	}
+
+	SQLite::Recorder::~Recorder() {
+
+		{
+			lock_guard<mutex> lock(guard);
+			enabled = false;
+		}
+		wakeup.notify_all();
+
+		if(thread.joinable()) {
+			thread.join();
+		}
+
+		try {
+			flush();
+		} catch(const std::exception &e) {
+			cerr << "sqlite\tError flushing '" << table << "': " << e.what() << endl;
+		}
+
+	}
+
+	void SQLite::Recorder::push(const char *agent, double value, time_t timestamp) {
+
+		lock_guard<mutex> lock(guard);
+		samples.push_back({agent,(timestamp ? timestamp : time(0)),value});
+
+		if(samples.size() >= batch) {
+			wakeup.notify_one();
+		}
+
+	}
+
+	void SQLite::Recorder::flush() {
+
+		std::vector<Sample> buffer;
+		{
+			lock_guard<mutex> lock(guard);
+			buffer.swap(samples);
+		}
+
+		if(buffer.empty()) {
+			return;
+		}
+
+		Statement stmt{database,(string{"insert or replace into "} + table + " (agent,timestamp,value) values (?,?,?)").c_str()};
+
+		Transaction transaction{database};
+		for(auto &sample : buffer) {
+			stmt.bind(1,std::string_view{sample.agent});
+			stmt.bind(2,(int64_t) sample.timestamp);
+			stmt.bind(3,sample.value);
+			stmt.exec();
+			stmt.reset();
+		}
+		transaction.commit();
+
+	}
+
+	void SQLite::Recorder::rollup(const std::string &from, const std::string &to, time_t interval, bool raw) {
+
+		// Restart from the last (possibly incomplete) bucket.
+		int64_t start = 0;
+		{
+			Statement stmt{database,(string{"select coalesce(max(timestamp),0) from "} + to).c_str()};
+			stmt.step();
+			stmt.get(0,start);
+		}
+
+		int64_t end = (time(0) / interval) * interval;
+		if(start >= end) {
+			return;
+		}
+
+		string sql{"insert or replace into "};
+		sql += to;
+		sql += " (agent,timestamp,min,max,avg,count) select agent,(timestamp/?1)*?1,";
+		if(raw) {
+			sql += "min(value),max(value),avg(value),count(*)";
+		} else {
+			sql += "min(min),max(max),sum(avg*count)/sum(count),sum(count)";
+		}
+		sql += " from ";
+		sql += from;
+		sql += " where timestamp >= ?2 and timestamp < ?3 group by agent,timestamp/?1";
+
+		Statement stmt{database,sql.c_str()};
+		stmt.bind(1,(int64_t) interval);
+		stmt.bind(2,start);
+		stmt.bind(3,end);
+		stmt.exec();
+
+	}
+
+	void SQLite::Recorder::expire(const std::string &name, time_t seconds) {
+		if(seconds) {
+			Statement stmt{database,(string{"delete from "} + name + " where timestamp < ?").c_str()};
+			stmt.bind(1,(int64_t) (time(0) - seconds));
+			stmt.exec();
+		}
+	}
+
+	void SQLite::Recorder::rollup() {
+
+		Transaction transaction{database};
+
+		rollup(table,table+"_minute",60,true);
+		rollup(table+"_minute",table+"_hour",3600,false);
+
+		expire(table,retention.samples);
+		expire(table+"_minute",retention.minutes);
+		expire(table+"_hour",retention.hours);
+
+		transaction.commit();
+
+	}
+
+ }
@@ -23,6 +23,7 @@
  #include <iostream>
  #include <cstring>
  #include <cstdarg>
+ #include <cctype>
 
  using namespace std;
 
@@ -34,7 +35,7 @@
 			throw runtime_error("Database is not available");
 		}
 
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		database->check(sqlite3_prepare_v2(
 			database->db,		// Database handle
 			sql,				// SQL statement, UTF-8 encoded
@@ -46,31 +47,146 @@
  	}
 
  	SQLite::Statement::~Statement() {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		sqlite3_finalize(stmt);
  	}
 
+	void SQLite::Statement::check(int column, Affinity affinity) {
+
+		if(column >= sqlite3_column_count(stmt)) {
+			throw runtime_error(string{"Statement has no column "} + std::to_string(column));
+		}
+
+		const char *type = sqlite3_column_decltype(stmt,column);
+		if(!type) {
+			// Expression, no declared type.
+			return;
+		}
+
+		string name{type};
+		for(auto &chr : name) {
+			chr = toupper(chr);
+		}
+
+		// https://www.sqlite.org/datatype3.html#determination_of_column_affinity
+		bool integer = (name.find("INT") != string::npos);
+		bool text = !integer && (name.find("CHAR") != string::npos || name.find("CLOB") != string::npos || name.find("TEXT") != string::npos);
+		bool real = !(integer || text) && (name.find("REAL") != string::npos || name.find("FLOA") != string::npos || name.find("DOUB") != string::npos);
+
+		if((affinity == Integer && (text || real)) || (affinity == Real && text)) {
+			throw runtime_error(
+				string{"Column '"} + sqlite3_column_name(stmt,column) + "' is declared as '" + type + "', not compatible with the requested type"
+			);
+		}
+
+	}
+
 	void SQLite::Statement::reset() {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		sqlite3_reset(stmt);
 	}
 
 	int SQLite::Statement::step() {
-		lock_guard<std::mutex> lock(database->guard);
-		return sqlite3_step(stmt);
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		return run();
+	}
+
+	SQLite::Statement & SQLite::Statement::timeout(unsigned int milliseconds) {
+		budget = chrono::milliseconds(milliseconds);
+		return *this;
+	}
+
+	SQLite::Statement & SQLite::Statement::cancellable(std::shared_ptr<Cancellation> token) {
+		this->token = token;
+		return *this;
+	}
+
+	int SQLite::Statement::progress(void *context) {
+
+		Statement *statement = (Statement *) context;
+
+		if(statement->token && statement->token->cancelled()) {
+			return 1;
+		}
+
+		if(statement->budget.count() && chrono::steady_clock::now() > statement->deadline) {
+			return 1;
+		}
+
+		return 0;
+	}
+
+	int SQLite::Statement::run() {
+
+		if(!(budget.count() || token)) {
+			return sqlite3_step(stmt);
+		}
+
+		// The handler is per connection, install it only while this statement runs.
+		deadline = chrono::steady_clock::now() + budget;
+		sqlite3_progress_handler(database->db, 1000, progress, this);
+		int rc = sqlite3_step(stmt);
+		sqlite3_progress_handler(database->db, 0, nullptr, nullptr);
+
+		if(rc == SQLITE_INTERRUPT) {
+
+			sqlite3_reset(stmt);
+
+			if(token && token->cancelled()) {
+				database->aborted.cancelled++;
+				throw runtime_error(string{"Statement was cancelled: "} + sqlite3_sql(stmt));
+			}
+
+			database->aborted.timeouts++;
+			throw runtime_error(string{"Statement exceeded its "} + std::to_string(budget.count()) + "ms budget: " + sqlite3_sql(stmt));
+
+		}
+
+		return rc;
+	}
+
+	int SQLite::Statement::parameters() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		return sqlite3_bind_parameter_count(stmt);
+	}
+
+	int SQLite::Statement::parameter(const char *name) {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		return sqlite3_bind_parameter_index(stmt,name);
+	}
+
+	int SQLite::Statement::columns() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		return sqlite3_column_count(stmt);
 	}
 
 	void SQLite::Statement::exec() {
 		database->check(step());
 	}
 
+	int64_t SQLite::Statement::insert() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(run());
+		if(!sqlite3_changes(database->db)) {
+			// 'ON CONFLICT DO NOTHING', the last rowid is from another insert.
+			return 0;
+		}
+		return sqlite3_last_insert_rowid(database->db);
+	}
+
+	int SQLite::Statement::update() {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(run());
+		return sqlite3_changes(database->db);
+	}
+
 	void SQLite::Statement::get(int column, int64_t &value) {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		value = sqlite3_column_int64(stmt,column);
 	}
 
 	void SQLite::Statement::get(int column, string &value) {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		const char *str = (const char *) sqlite3_column_text(stmt,column);
 		if(str)
 			value = str;
@@ -78,8 +194,13 @@
 			value.clear();
 	}
 
+	void SQLite::Statement::get(int column, double &value) {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		value = sqlite3_column_double(stmt,column);
+	}
+
 	SQLite::Statement & SQLite::Statement::bind(int column, const char *value) {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		database->check(
 			sqlite3_bind_text(
 				stmt,
@@ -91,8 +212,22 @@
 		return *this;
 	}
 
+	SQLite::Statement & SQLite::Statement::bind(int column, const std::string_view &value) {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(
+			sqlite3_bind_text64(
+				stmt,
+				column,
+				value.data(),
+				(sqlite3_uint64) value.size(),
+				SQLITE_TRANSIENT,
+				SQLITE_UTF8
+			)	);
+		return *this;
+	}
+
 	SQLite::Statement & SQLite::Statement::bind(int column, const int64_t value) {
-		lock_guard<std::mutex> lock(database->guard);
+		lock_guard<std::recursive_mutex> lock(database->guard);
 		database->check(
 			sqlite3_bind_int64(
 				stmt,
@@ -102,6 +237,28 @@
 		return *this;
 	}
 
+	SQLite::Statement & SQLite::Statement::bind(int column, const double value) {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(
+			sqlite3_bind_double(
+				stmt,
+				column,
+				value
+			)	);
+		return *this;
+	}
+
+	SQLite::Statement & SQLite::Statement::zeroblob(int column, size_t length) {
+		lock_guard<std::recursive_mutex> lock(database->guard);
+		database->check(
+			sqlite3_bind_zeroblob64(
+				stmt,
+				column,
+				(sqlite3_uint64) length
+			)	);
+		return *this;
+	}
+
 	SQLite::Statement & SQLite::Statement::bind(const char *arg,...) {
 
 		size_t column = 0;
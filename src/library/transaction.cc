@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/transaction.h>
+ #include <iostream>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Transaction::Transaction(std::shared_ptr<Database> db) : database(db), lock(db->guard) {
+		database->exec("BEGIN TRANSACTION");
+		active = true;
+	}
+
+	SQLite::Transaction::~Transaction() {
+		if(active) {
+			try {
+				rollback();
+			} catch(const std::exception &e) {
+				cerr << "sqlite\tError on rollback: " << e.what() << endl;
+			}
+		}
+	}
+
+	void SQLite::Transaction::commit() {
+		if(active) {
+			// On failure it's still active, the destructor will roll it back.
+			database->exec("COMMIT");
+			active = false;
+			lock.unlock();
+		}
+	}
+
+	void SQLite::Transaction::rollback() {
+		if(active) {
+			active = false;
+			try {
+				database->exec("ROLLBACK");
+			} catch(...) {
+				lock.unlock();
+				throw;
+			}
+			lock.unlock();
+		}
+	}
+
+ }
@@ -32,6 +32,10 @@
  #include <udjat/tools/logger.h>
  #include <udjat/module.h>
  #include <udjat/sqlite/sql.h>
+ #include <udjat/sqlite/recorder.h>
+ #include <cstdlib>
+ #include <algorithm>
+ #include <cstring>
 
  using namespace std;
 
@@ -47,22 +51,146 @@
 		#define DBNAME "sqlite.db"
 #endif // DEBUG
 
-		return make_shared<SQLite::Database>(Config::Value<string>("sql","dbname",DBNAME).c_str());
+		std::shared_ptr<SQLite::Database> database;
+		if(!strcasecmp(Config::Value<string>("sql","mode","file").c_str(),"memory")) {
+			database = make_shared<SQLite::Database>(
+				Config::Value<string>("sql","dbname",DBNAME).c_str(),
+				(time_t) Config::Value<unsigned int>("sql","checkpoint",30)
+			);
+		} else {
+			database = make_shared<SQLite::Database>(Config::Value<string>("sql","dbname",DBNAME).c_str());
+		}
+
+		database->busy(Config::Value<unsigned int>("sql","busy-timeout",5000));
+
+		if(!strcasecmp(Config::Value<string>("sql","journal-mode","").c_str(),"wal")) {
+			database->wal(
+				(time_t) Config::Value<unsigned int>("sql","wal-checkpoint",10),
+				Config::Value<unsigned int>("sql","wal-size",1000)
+			);
+		}
+
+		SQLite::Database::limits(
+			((int64_t) Config::Value<unsigned int>("sql","soft-heap-limit",0)) * 1024,
+			((int64_t) Config::Value<unsigned int>("sql","hard-heap-limit",0)) * 1024
+		);
+
+		{
+			unsigned int kib = Config::Value<unsigned int>("sql","cache-size",0);
+			if(kib) {
+				database->cache(kib);
+			}
+		}
+
+		if(Config::Value<bool>("sql","profile",false)) {
+			database->profile(Config::Value<unsigned int>("sql","slow-statement",100));
+		}
+
+		return database;
 
 	}
 
 	std::shared_ptr<SQLite::Database> DatabaseFactory(const pugi::xml_node &node) {
-		return make_shared<SQLite::Database>(Application::DataFile(node,"dbname",true).c_str());
+
+		std::shared_ptr<SQLite::Database> database;
+		if(!strcasecmp(node.attribute("mode").as_string(Config::Value<string>("sql","mode","file").c_str()),"memory")) {
+			database = make_shared<SQLite::Database>(
+				Application::DataFile(node,"dbname",true).c_str(),
+				(time_t) Object::getAttribute(node,"sql","checkpoint",(unsigned int) 30)
+			);
+		} else {
+			database = make_shared<SQLite::Database>(Application::DataFile(node,"dbname",true).c_str());
+		}
+
+		database->busy(Object::getAttribute(node,"sql","busy-timeout",(unsigned int) 5000));
+
+		if(!strcasecmp(node.attribute("journal-mode").as_string(Config::Value<string>("sql","journal-mode","").c_str()),"wal")) {
+			database->wal(
+				(time_t) Object::getAttribute(node,"sql","wal-checkpoint",(unsigned int) 10),
+				Object::getAttribute(node,"sql","wal-size",(unsigned int) 1000)
+			);
+		}
+
+		SQLite::Database::limits(
+			((int64_t) Object::getAttribute(node,"sql","soft-heap-limit",(unsigned int) 0)) * 1024,
+			((int64_t) Object::getAttribute(node,"sql","hard-heap-limit",(unsigned int) 0)) * 1024
+		);
+
+		{
+			unsigned int kib = Object::getAttribute(node,"sql","cache-size",(unsigned int) 0);
+			if(kib) {
+				database->cache(kib);
+			}
+		}
+
+		if(node.attribute("profile").as_bool(Config::Value<bool>("sql","profile",false))) {
+			database->profile(Object::getAttribute(node,"sql","slow-statement",(unsigned int) 100));
+		}
+
+		return database;
+
 	}
 
 	SQLite::Module::Module() : Udjat::Module("sqlite",moduleinfo), Udjat::Factory("sql",moduleinfo), database(DatabaseFactory()) {
+
+		SQLite::Database::setInstance(database);
+
+		timeout = Config::Value<unsigned int>("sql","shutdown-timeout",(unsigned int) timeout);
+
+		size_t threads = Config::Value<unsigned int>("sql","sender-threads",0);
+		if(threads) {
+			scheduler.reset(new Scheduler(threads));
+			scheduler->quantum = Config::Value<unsigned int>("sql","sender-quantum",(unsigned int) scheduler->quantum);
+			scheduler->bandwidth = Config::Value<unsigned int>("sql","sender-bandwidth",(unsigned int) scheduler->bandwidth);
+			scheduler->retry = Config::Value<unsigned int>("sql","sender-retry",(unsigned int) scheduler->retry);
+		}
+
 	}
 
 	/// @brief Create module from XML definition with fallback to configuration file.
 	SQLite::Module::Module(const pugi::xml_node &node) : Udjat::Module("sqlite",moduleinfo), Udjat::Factory("sql",moduleinfo), database(DatabaseFactory(node)) {
+
+		SQLite::Database::setInstance(database);
+
+		timeout = Object::getAttribute(node,"sql","shutdown-timeout",(unsigned int) timeout);
+
+		size_t threads = Object::getAttribute(node,"sql","sender-threads",(unsigned int) 0);
+		if(threads) {
+			scheduler.reset(new Scheduler(threads));
+			scheduler->quantum = Object::getAttribute(node,"sql","sender-quantum",(unsigned int) scheduler->quantum);
+			scheduler->bandwidth = Object::getAttribute(node,"sql","sender-bandwidth",(unsigned int) scheduler->bandwidth);
+			scheduler->retry = Object::getAttribute(node,"sql","sender-retry",(unsigned int) scheduler->retry);
+		}
+
 	}
 
 	SQLite::Module::~Module() {
+
+		// Stop all queues and the sender threads with a single deadline.
+		auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+		{
+			size_t interrupted = 0;
+			for(auto &protocol : protocols) {
+				if(!protocol->stop(deadline)) {
+					interrupted++;
+				}
+			}
+			if(interrupted) {
+				Udjat::Factory::warning() << interrupted << " queue(s) interrupted after the " << timeout << " seconds shutdown deadline" << endl;
+			}
+		}
+
+		if(scheduler) {
+			Udjat::Factory::info() << "Stopping module sender" << endl;
+			if(scheduler->stop(deadline)) {
+				scheduler.reset();
+			} else {
+				// Detached workers are still using it.
+				Udjat::Factory::warning() << "Module sender still waiting for the network after the shutdown deadline" << endl;
+				scheduler.release();
+			}
+		}
+
 		auto count = database.use_count();
 		if(count > 2) {
 			Udjat::Factory::warning() << "Closing module with " << count << " active database instance(s) " << endl;
@@ -105,6 +233,9 @@
 					throw runtime_error("Cant cast module as volatile");
 				}
 				module->protocols.push_back(protocol);
+				if(module->scheduler) {
+					module->scheduler->push_back(protocol);
+				}
 			}
 
 			//
@@ -114,6 +245,9 @@
 			private:
 				shared_ptr<Protocol> protocol;
 
+				/// @brief Module sender, if enabled the agent only updates the queue size.
+				Scheduler *scheduler;
+
 				struct {
 					time_t success = 2;		///< @brief How many seconds to wait after a successfull send.
 					time_t failed = 14400;	///< @brief How many seconds to wait when failed.
@@ -127,7 +261,7 @@
 				} retry;
 
 			public:
-				Agent(shared_ptr<Protocol> p, const XML::Node &node) : Udjat::Agent<unsigned int>(node), protocol(p) {
+				Agent(shared_ptr<Protocol> p, Scheduler *s, const XML::Node &node) : Udjat::Agent<unsigned int>(node), protocol(p), scheduler(s) {
 					protocol->insert(this);
 				}
 
@@ -173,6 +307,12 @@
 
 				bool refresh() override {
 
+					if(scheduler) {
+						set((unsigned int) protocol->size());
+						scheduler->refresh();
+						return true;
+					}
+
 					retry.count++;
 					trace() << "Sending pending requests (" << retry.count << "/" << retry.max << ")" << endl;
 
@@ -185,6 +325,15 @@
 
 						time_t timer = (count > 0 ? timers.success : timers.empty);
 
+						if(count > 0 && protocol->scheduled()) {
+							// Wait for the next due request.
+							time_t now = time(0);
+							time_t due = protocol->due();
+							if(due > now) {
+								timer = std::max(timers.success, due - now);
+							}
+						}
+
 						if(timer) {
 							time_t next = sched_update(timer);
 							if(Logger::enabled(Logger::Debug)) {
@@ -195,7 +344,25 @@
 					} else {
 
 						// No data was sent, just set value and keep the original timer.
-						set((unsigned int) protocol->count());
+						unsigned int count = protocol->count();
+						set(count);
+
+						if(protocol->scheduled()) {
+
+							// Nothing due is not a failure, wake up when the next request is due.
+							time_t now = time(0);
+							time_t due = (count ? protocol->due() : 0);
+
+							if(!count || due > now) {
+								retry.count = 0;
+								time_t next = sched_update(count ? (due - now) : timers.empty);
+								if(Logger::enabled(Logger::Debug)) {
+									Logger::String{"Next request due ",TimeStamp{next}.to_string()}.write(Logger::Debug,name());
+								}
+								return true;
+							}
+
+						}
 
 						time_t next;
 						Logger::Level level = Logger::Trace;
@@ -245,7 +412,124 @@
 
 			};
 
-			return make_shared<Agent>(protocol,node);
+			return make_shared<Agent>(protocol,scheduler.get(),node);
+		}
+
+		if( type == "memory") {
+			//
+			// SQLite memory usage, in KiB.
+			//
+			class Agent : public Udjat::Agent<unsigned int> {
+			private:
+				shared_ptr<Database> database;
+
+				/// @brief Release connection memory when using more than this (KiB, 0 to disable).
+				unsigned int limit = 0;
+
+			public:
+				Agent(shared_ptr<Database> db, const XML::Node &node) : Udjat::Agent<unsigned int>(node), database(db) {
+					limit = Object::getAttribute(node, "sqlite", "release-above", (unsigned int) limit);
+				}
+
+				bool getProperties(const char *path, Report &report) const override {
+
+					if(super::getProperties(path,report)) {
+						return true;
+					}
+
+					if(*path == '/') {
+						path++;
+					}
+
+					if(!strcasecmp(path,"memory")) {
+						database->status(report);
+						return true;
+					}
+
+					return false;
+
+				}
+
+				bool refresh() override {
+
+					unsigned int kib = (unsigned int) (sqlite3_memory_used() / 1024);
+
+					if(limit && kib > limit) {
+						info() << "Using " << kib << "KiB, releasing memory" << endl;
+						database->release();
+						kib = (unsigned int) (sqlite3_memory_used() / 1024);
+					}
+
+					return set(kib);
+
+				}
+
+			};
+
+			return make_shared<Agent>(database,node);
+		}
+
+		if( type == "recorder") {
+			//
+			// Store values of other agents on a time-series table.
+			//
+			class Agent : public Udjat::Agent<unsigned int> {
+			private:
+				Recorder recorder;
+
+				/// @brief Paths of the recorded agents.
+				std::vector<std::string> paths;
+
+			public:
+				Agent(shared_ptr<Database> database, const XML::Node &node) : Udjat::Agent<unsigned int>(node), recorder(database,node) {
+
+					String agents{node.attribute("agents").as_string()};
+					for(auto &path : agents.split(",")) {
+						path.strip();
+						if(!path.empty()) {
+							paths.push_back(path);
+						}
+					}
+
+					if(paths.empty()) {
+						throw runtime_error("Required attribute 'agents' is empty or missing");
+					}
+
+				}
+
+				bool refresh() override {
+
+					unsigned int recorded = 0;
+					time_t now = time(0);
+
+					for(auto &path : paths) {
+
+						auto agent = Abstract::Agent::root()->find(path.c_str());
+						if(!agent) {
+							continue;
+						}
+
+						string value{agent->to_string()};
+						char *end = nullptr;
+						double number = strtod(value.c_str(),&end);
+
+						if(end == value.c_str()) {
+							debug("Ignoring non numeric value '",value,"' from ",path);
+							continue;
+						}
+
+						recorder.push(path.c_str(),number,now);
+						recorded++;
+
+					}
+
+					return set(recorded);
+
+				}
+
+			};
+
+			return make_shared<Agent>(database,node);
 		}
 
 		return Udjat::Factory::AgentFactory(parent,node);
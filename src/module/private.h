@@ -30,12 +30,92 @@
  #include <string>
  #include <list>
  #include <vector>
+ #include <memory>
+ #include <mutex>
+ #include <thread>
+ #include <condition_variable>
+ #include <chrono>
  #include <udjat/moduleinfo.h>
 
  namespace Udjat {
 
 	namespace SQLite {
 
+		/// @brief Sender for all queue protocols, deficit round robin with global concurrency and bandwidth caps.
+		class UDJAT_PRIVATE Scheduler {
+		private:
+
+			struct Queue {
+				std::shared_ptr<Protocol> protocol;
+				int64_t deficit = 0;	///< @brief Bytes this queue can still send on this round.
+				time_t delay = 0;		///< @brief Don't send before this time (after a failure).
+				bool busy = false;		///< @brief A worker is sending from this queue.
+				int64_t size = -1;		///< @brief Cached queue size (-1 when unknown).
+				time_t due = 0;			///< @brief Cached time of the earliest scheduled request (0 if none).
+				time_t updated = 0;		///< @brief When size and due were cached.
+				bool stale = true;		///< @brief The cached values must be updated.
+				bool updating = false;	///< @brief A worker is updating the cached values.
+			};
+
+			std::mutex guard;
+			std::condition_variable wakeup;
+			std::vector<Queue> queues;
+			std::vector<std::thread> workers;
+			size_t next = 0;			///< @brief Next queue on the round.
+			bool enabled = true;
+
+			/// @brief Number of running workers.
+			size_t running = 0;
+			std::condition_variable exited;
+
+			/// @brief Bandwidth token bucket.
+			struct {
+				int64_t tokens = 0;
+				std::chrono::steady_clock::time_point updated;
+			} bucket;
+
+			/// @brief Get next queue to send from, nullptr if none (call with guard locked).
+			/// @details Uses only the cached queue values, there's no database access here.
+			Queue * select();
+
+			/// @brief Update the cached values of stale queues, the queries run with the lock released.
+			void update(std::unique_lock<std::mutex> &lock);
+
+			/// @brief Store the cached values of a queue (call with guard locked).
+			void set(const std::shared_ptr<Protocol> &protocol, int64_t size, time_t due);
+
+			/// @brief Wait for bandwidth (call with guard locked).
+			void throttle(std::unique_lock<std::mutex> &lock);
+
+			void work();
+
+		public:
+
+			/// @brief Bytes added to a queue deficit on each round.
+			size_t quantum = 65536;
+
+			/// @brief Max bytes per second (0 for unlimited).
+			size_t bandwidth = 0;
+
+			/// @brief Seconds to skip a queue after a failure.
+			time_t retry = 60;
+
+			Scheduler(size_t threads);
+			~Scheduler();
+
+			/// @brief Stop the workers.
+			/// @param deadline Workers still sending after it are detached, the scheduler must be leaked then.
+			/// @return true if all workers finished.
+			bool stop(const std::chrono::steady_clock::time_point &deadline);
+
+			/// @brief Add queue protocol.
+			void push_back(std::shared_ptr<Protocol> protocol);
+
+			/// @brief Wake up workers (requests were queued).
+			void refresh();
+
+		};
+
 		class UDJAT_PRIVATE Module : public Udjat::Module, public Udjat::Factory {
 		public:
 
@@ -47,6 +127,12 @@
 			// @brief List of active protocols.
 			std::vector<std::shared_ptr<Protocol>> protocols;
 
+			// @brief Module wide sender (nullptr if disabled).
+			std::unique_ptr<Scheduler> scheduler;
+
+			// @brief Seconds to stop the queues on shutdown.
+			time_t timeout = 10;
+
 		public:
 			Module();
 			Module(const pugi::xml_node &node);
@@ -0,0 +1,324 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/tools/logger.h>
+ #include <algorithm>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	SQLite::Scheduler::Scheduler(size_t threads) {
+
+		bucket.updated = chrono::steady_clock::now();
+
+		if(!threads) {
+			threads = 1;
+		}
+
+		running = threads;
+		for(size_t ix = 0; ix < threads; ix++) {
+			workers.emplace_back([this](){
+				work();
+			});
+		}
+
+	}
+
+	SQLite::Scheduler::~Scheduler() {
+
+		{
+			lock_guard<mutex> lock(guard);
+			enabled = false;
+		}
+		wakeup.notify_all();
+
+		for(auto &worker : workers) {
+			if(worker.joinable()) {
+				worker.join();
+			}
+		}
+
+	}
+
+	bool SQLite::Scheduler::stop(const std::chrono::steady_clock::time_point &deadline) {
+
+		bool finished;
+		{
+			unique_lock<mutex> lock(guard);
+			enabled = false;
+			wakeup.notify_all();
+			finished = exited.wait_until(lock,deadline,[this]{ return !running; });
+		}
+
+		// A send blocked on the network can't be interrupted, let it finish on its own.
+		for(auto &worker : workers) {
+			if(finished) {
+				worker.join();
+			} else {
+				worker.detach();
+			}
+		}
+
+		return finished;
+
+	}
+
+	void SQLite::Scheduler::push_back(std::shared_ptr<Protocol> protocol) {
+		{
+			lock_guard<mutex> lock(guard);
+			queues.emplace_back();
+			queues.back().protocol = protocol;
+		}
+		wakeup.notify_one();
+	}
+
+	void SQLite::Scheduler::refresh() {
+		{
+			lock_guard<mutex> lock(guard);
+			for(auto &queue : queues) {
+				queue.stale = true;
+			}
+		}
+		wakeup.notify_all();
+	}
+
+	/// @brief Get queue size and the earliest scheduled request (runs queries when they aren't known).
+	static void measure(SQLite::Protocol &protocol, int64_t &size, time_t &due) noexcept {
+
+		size = -1;
+		due = 0;
+
+		try {
+
+			size = protocol.size();
+			if(size > 0 && protocol.scheduled()) {
+				due = protocol.due();
+			}
+
+		} catch(const std::exception &e) {
+
+			Logger::String{"Can't get queue size: ",e.what()}.write(Logger::Error,protocol.c_str());
+
+		}
+
+	}
+
+	void SQLite::Scheduler::set(const std::shared_ptr<Protocol> &protocol, int64_t size, time_t due) {
+		for(auto &queue : queues) {
+			if(queue.protocol == protocol) {
+				queue.size = size;
+				queue.due = due;
+				queue.updated = time(0);
+				queue.updating = false;
+				if(size < 0) {
+					queue.stale = true;
+				}
+				break;
+			}
+		}
+	}
+
+	void SQLite::Scheduler::update(std::unique_lock<std::mutex> &lock) {
+
+		time_t now = time(0);
+		std::vector<std::shared_ptr<Protocol>> protocols;
+
+		for(auto &queue : queues) {
+			// Stale, or delayed since the last update (a scheduled request can be due now).
+			if(!(queue.busy || queue.updating) && (queue.stale || (queue.delay && queue.delay <= now && queue.updated < queue.delay))) {
+				// Cleared before the queries, a refresh() while updating marks it again.
+				queue.stale = false;
+				queue.updating = true;
+				protocols.push_back(queue.protocol);
+			}
+		}
+
+		if(protocols.empty()) {
+			return;
+		}
+
+		std::vector<std::pair<int64_t,time_t>> values(protocols.size());
+
+		lock.unlock();
+		for(size_t ix = 0; ix < protocols.size(); ix++) {
+			measure(*protocols[ix],values[ix].first,values[ix].second);
+		}
+		lock.lock();
+
+		for(size_t ix = 0; ix < protocols.size(); ix++) {
+			set(protocols[ix],values[ix].first,values[ix].second);
+		}
+
+	}
+
+	SQLite::Scheduler::Queue * SQLite::Scheduler::select() {
+
+		time_t now = time(0);
+
+		// The first pass uses the remaining deficits, the next ones add a quantum to each queue.
+		for(size_t pass = 0; ; pass++) {
+
+			bool eligible = false;
+
+			for(size_t ix = 0; ix < queues.size(); ix++) {
+
+				Queue &queue = queues[(next + ix) % queues.size()];
+
+				if(queue.busy || queue.delay > now || queue.size <= 0) {
+					// Idle queues don't keep credits.
+					if(!queue.busy && queue.delay <= now) {
+						queue.deficit = 0;
+					}
+					continue;
+				}
+
+				// Scheduled requests not yet due aren't a failure, wait for them (or for the retry time).
+				if(queue.due > now) {
+					queue.delay = std::min(queue.due, now + retry);
+					queue.deficit = 0;
+					continue;
+				}
+
+				eligible = true;
+
+				if(pass) {
+					queue.deficit += std::max(quantum,(size_t) 1);
+				}
+
+				if(queue.deficit > 0) {
+					next = (next + ix) % queues.size();
+					return &queue;
+				}
+
+			}
+
+			if(!eligible) {
+				break;
+			}
+
+		}
+
+		return nullptr;
+
+	}
+
+	void SQLite::Scheduler::throttle(std::unique_lock<std::mutex> &lock) {
+
+		while(bandwidth && enabled) {
+
+			auto now = chrono::steady_clock::now();
+			auto elapsed = chrono::duration_cast<chrono::milliseconds>(now - bucket.updated).count();
+
+			bucket.tokens = std::min((int64_t) bandwidth, bucket.tokens + (int64_t) ((elapsed * bandwidth) / 1000));
+			bucket.updated = now;
+
+			if(bucket.tokens > 0) {
+				return;
+			}
+
+			wakeup.wait_for(lock,chrono::milliseconds(((-bucket.tokens * 1000) / bandwidth) + 1));
+
+		}
+
+	}
+
+	void SQLite::Scheduler::work() {
+
+		unique_lock<mutex> lock(guard);
+
+		while(enabled) {
+
+			// Wait for bandwidth before selecting, throttle() releases the lock.
+			throttle(lock);
+			if(!enabled) {
+				break;
+			}
+
+			update(lock);
+			if(!enabled) {
+				break;
+			}
+
+			Queue *queue = select();
+			if(!queue) {
+				wakeup.wait_for(lock,chrono::seconds(1));
+				continue;
+			}
+
+			queue->busy = true;
+			queue->stale = false;	// Updated after the send.
+			auto protocol = queue->protocol;
+
+			lock.unlock();
+
+			size_t bytes = 0;
+			bool success = protocol->send(bytes);
+
+			int64_t size;
+			time_t due;
+			measure(*protocol,size,due);
+
+			lock.lock();
+
+			set(protocol,size,due);
+
+			// The vector doesn't change after startup but get the queue again to be safe.
+			for(auto &entry : queues) {
+				if(entry.protocol == protocol) {
+
+					entry.busy = false;
+					entry.deficit -= bytes;
+
+					if(!success) {
+						entry.deficit = 0;
+						entry.delay = time(0) + retry;
+						Logger::String{"Unable to send, will retry in ",retry," seconds"}.write(Logger::Trace,protocol->c_str());
+					}
+
+					// Keep serving this queue while it has credits, otherwise move to the next one.
+					if(entry.deficit <= 0) {
+						next++;
+					}
+
+					break;
+				}
+			}
+
+			if(bandwidth) {
+				bucket.tokens -= bytes;
+			}
+
+			if(!success || size <= 0) {
+				// Update agents.
+				lock.unlock();
+				protocol->refresh();
+				lock.lock();
+			}
+
+		}
+
+		running--;
+		exited.notify_all();
+
+	}
+
+ }
@@ -22,19 +22,471 @@
  #include <udjat/tools/application.h>
  #include <udjat/tools/http/client.h>
  #include <udjat/tools/logger.h>
+ #include <udjat/tools/mainloop.h>
  #include <udjat/agent.h>
  #include <udjat/factory.h>
  #include <udjat/module.h>
  #include <iostream>
  #include <memory>
+ #include <cstring>
+
+#ifndef _WIN32
+ #include <udjat/sqlite/database.h>
+ #include <udjat/sqlite/statement.h>
+ #include <udjat/sqlite/protocol.h>
+ #include <pugixml.hpp>
+ #include <unordered_map>
+ #include <unordered_set>
+ #include <algorithm>
+ #include <fstream>
+ #include <random>
+ #include <vector>
+ #include <thread>
+ #include <chrono>
+ #include <atomic>
+ #include <mutex>
+ #include <cstdlib>
+ #include <cerrno>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <signal.h>
+ #include <sys/wait.h>
+#endif // _WIN32
 
  using namespace std;
  using namespace Udjat;
 
+//---[ Stress ]---------------------------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+ /// @brief Crash test: producers and senders on the SQL protocol queue, killed and restarted on each run.
+ /// @details Producers enqueue with the protocol worker, senders run Protocol::send() with leases and
+ /// deliver to a local sink (an append-only file) instead of HTTP. Producers log each request after the
+ /// worker returns, so an acknowledged request missing from both the queue and the sink was lost.
+ /// Requests on the sink more than once were redelivered (at-least-once delivery).
+ namespace Stress {
+
+	static const char *dbname = "stress.db";
+	static const char *acked = "stress.acked";
+	static const char *sent = "stress.sent";
+
+	static const char * option(const char *name, const char *def) {
+		const char *value = getenv(name);
+		return (value && *value) ? value : def;
+	}
+
+	static void append(int fd, const string &key) {
+		string line{key + "\n"};
+		if(write(fd,line.c_str(),line.size()) != (ssize_t) line.size()) {
+			cerr << "stress\tError writing log" << endl;
+		}
+	}
+
+	/// @brief The SQL protocol definition, one per sender (the lease owner).
+	static string definition(const char *name) {
+
+		bool blob = atoi(option("STRESS_BLOB","0"));
+
+		string xml{"<protocol name='"};
+		xml += name;
+		xml += "' owner='";
+		xml += name;
+		xml += "' lease-time='5' retry-delay='0' buffer-size='";
+		xml += option("STRESS_BUFFER","0");
+		xml += "'";
+		if(blob) {
+			xml += " blob-table='queue'";
+		}
+		xml += R"(>
+			<init>
+				create table if not exists queue (id integer primary key, url text not null, action text not null, payload blob, key integer unique, owner text, lease integer default 0)
+			</init>
+			<insert>
+				insert into queue (url,action,payload,key) values (?1,?2,?3,:key) on conflict(key) do nothing
+			</insert>
+			<claim>
+				update queue set owner=?1, lease=unixepoch()+?2 where id = (select id from queue where lease &lt; unixepoch() order by id limit 1) returning )";
+		xml += (blob ? "id,url,action" : "id,url,action,payload");
+		xml += R"(
+			</claim>
+			<delete>
+				delete from queue where id=?1 and owner=?2
+			</delete>
+			<release>
+				update queue set owner=null, lease=0 where id=?1 and owner=?2
+			</release>
+			<pending>
+				select count(*) from queue
+			</pending>
+		</protocol>)";
+
+		return xml;
+	}
+
+	/// @brief SQL protocol delivering to the sink file.
+	class Sink : public SQLite::Protocol {
+	private:
+		int fd;
+
+	protected:
+		void deliver(HTTP::Method, const Udjat::URL &, const std::string &payload) override {
+			append(fd,payload);
+		}
+
+	public:
+		Sink(std::shared_ptr<SQLite::Database> db, const pugi::xml_node &node, int f) : SQLite::Protocol{db,node}, fd{f} {
+		}
+
+	};
+
+	static std::shared_ptr<Sink> factory(std::shared_ptr<SQLite::Database> database, const char *name, int fd) {
+		pugi::xml_document document;
+		string xml{definition(name)};
+		if(!document.load_string(xml.c_str())) {
+			throw runtime_error("Can't parse the stress protocol definition");
+		}
+		return make_shared<Sink>(database,document.document_element(),fd);
+	}
+
+	/// @brief Latency histogram, 8 buckets for each power of two microseconds.
+	class Histogram {
+	private:
+		std::atomic<uint64_t> buckets[496];
+		std::atomic<uint64_t> maximum{0};
+
+		static size_t index(uint64_t value) noexcept {
+			if(value < 8) {
+				return value;
+			}
+			unsigned int bits = 63 - __builtin_clzll(value);
+			return ((bits - 2) * 8) + ((value >> (bits - 3)) & 7);
+		}
+
+		/// @brief Upper limit of the bucket.
+		static uint64_t limit(size_t index) noexcept {
+			if(index < 8) {
+				return index;
+			}
+			unsigned int bits = (index / 8) + 2;
+			return ((8 + (index % 8)) << (bits - 3)) + (((uint64_t) 1) << (bits - 3)) - 1;
+		}
+
+	public:
+		Histogram() {
+			for(auto &bucket : buckets) {
+				bucket = 0;
+			}
+		}
+
+		void insert(uint64_t value) noexcept {
+			buckets[index(value)].fetch_add(1,std::memory_order_relaxed);
+			uint64_t current = maximum.load(std::memory_order_relaxed);
+			while(value > current && !maximum.compare_exchange_weak(current,value,std::memory_order_relaxed));
+		}
+
+		uint64_t count() const noexcept {
+			uint64_t total = 0;
+			for(auto &bucket : buckets) {
+				total += bucket.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+		uint64_t max() const noexcept {
+			return maximum.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Get percentile (upper limit of its bucket).
+		uint64_t percentile(uint64_t total, unsigned int p) const noexcept {
+			uint64_t target = (total * p + 99) / 100, current = 0;
+			for(size_t ix = 0; ix < (sizeof(buckets)/sizeof(buckets[0])); ix++) {
+				current += buckets[ix].load(std::memory_order_relaxed);
+				if(current >= target) {
+					return limit(ix);
+				}
+			}
+			return max();
+		}
+
+	};
+
+	[[noreturn]] static void child(size_t run) {
+
+		size_t producers = atoi(option("STRESS_PRODUCERS","8"));
+		size_t senders = atoi(option("STRESS_SENDERS","4"));
+
+		// SIGTERM is handled by the main thread, block it before starting the workers.
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals,SIGTERM);
+		pthread_sigmask(SIG_BLOCK,&signals,NULL);
+
+		int ack = open(acked,O_WRONLY|O_CREAT|O_APPEND,0644);
+		int sink = open(sent,O_WRONLY|O_CREAT|O_APPEND,0644);
+
+		auto database = make_shared<SQLite::Database>(dbname);
+		database->exec((string{"PRAGMA journal_mode="} + option("STRESS_JOURNAL","wal")).c_str());
+		database->exec((string{"PRAGMA synchronous="} + option("STRESS_SYNCHRONOUS","normal")).c_str());
+
+		// The producers queue, then one queue on its own connection for each sender.
+		std::vector<std::shared_ptr<Sink>> queues;
+		queues.push_back(factory(database,"stress",sink));
+		for(size_t sender = 0; sender < senders; sender++) {
+			auto connection = database->connect();
+			queues.push_back(factory(connection ? connection : database,(string{"stress-sender-"} + to_string(sender)).c_str(),sink));
+		}
+
+		// Protocol::send() only runs with an active main loop.
+		std::thread([](){
+			MainLoop::getInstance().run();
+		}).detach();
+
+		for(size_t retry = 0; !MainLoop::getInstance() && retry < 100; retry++) {
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		Histogram latencies;
+		std::atomic<size_t> delivered{0};
+		std::atomic<bool> stopping{false};
+		std::vector<std::thread> workers, delivering;
+
+		for(size_t producer = 0; producer < producers; producer++) {
+			workers.emplace_back([&,producer](){
+				string previous;
+				for(size_t seq = 0; !stopping; seq++) {
+					// Repeat one request in each hundred, ignored as duplicate while the first one is queued.
+					string key{(seq % 100 == 99) ? previous : to_string(run) + "-" + to_string(producer) + "-" + to_string(seq)};
+					auto worker = queues[0]->WorkerFactory();
+					worker->url("http://localhost/stress").method(HTTP::Post).payload(key.c_str());
+					auto begin = chrono::steady_clock::now();
+					worker->get([](double, double){ return true; });
+					latencies.insert(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+					append(ack,key);
+					previous = key;
+				}
+			});
+		}
+
+		for(size_t sender = 1; sender < queues.size(); sender++) {
+			delivering.emplace_back([&,sender](){
+				for(;;) {
+					if(queues[sender]->send()) {
+						delivered++;
+					} else if(stopping) {
+						break;
+					} else {
+						this_thread::sleep_for(chrono::milliseconds(1));
+					}
+				}
+			});
+		}
+
+		auto begin = chrono::steady_clock::now();
+		struct timespec second{1,0};
+		for(;;) {
+
+			if(sigtimedwait(&signals,NULL,&second) == SIGTERM) {
+				break;
+			}
+
+			uint64_t count = latencies.count();
+			if(!count) {
+				continue;
+			}
+
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+			cout	<< "stress\tRun " << run
+					<< ": " << (size_t) (count / seconds) << " inserts/s"
+					<< ", " << (size_t) (delivered.load() / seconds) << " sends/s"
+					<< ", insert latency p50<=" << latencies.percentile(count,50)
+					<< "us p99<=" << latencies.percentile(count,99)
+					<< "us max=" << latencies.max() << "us" << endl;
+
+		}
+
+		// Graceful shutdown: stop producing, stop the queues (storing buffered requests), then the senders.
+		cout << "stress\tRun " << run << ": stopping" << endl;
+		stopping = true;
+		for(auto &worker : workers) {
+			worker.join();
+		}
+
+		auto deadline = chrono::steady_clock::now() + chrono::seconds(2);
+		bool clean = true;
+		for(auto &queue : queues) {
+			clean &= queue->stop(deadline);
+		}
+
+		for(auto &worker : delivering) {
+			worker.join();
+		}
+
+		cout << "stress\tRun " << run << ": stopped" << (clean ? "" : " with interrupted sends") << endl;
+		_exit(0);
+
+	}
+
+	/// @brief Verify the queue, the sink and the acknowledged requests.
+	/// @param runs Number of runs, each one can stop while sending (a sender delivers a request and stops before removing it).
+	static int verify(size_t runs) {
+
+		std::unordered_set<string> queued;
+		{
+			SQLite::Statement select{make_shared<SQLite::Database>(dbname),"select payload from queue"};
+			for(auto [key] : select.rows<string>()) {
+				queued.insert(key);
+			}
+		}
+
+		std::unordered_map<string,size_t> delivered;
+		{
+			ifstream in{sent};
+			string key;
+			while(getline(in,key)) {
+				delivered[key]++;
+			}
+		}
+
+		// A request acknowledged twice (the producers repeat some) can be delivered twice.
+		std::unordered_map<string,size_t> acks;
+		size_t lost = 0, redelivered = 0;
+		{
+			ifstream in{acked};
+			string key;
+			while(getline(in,key)) {
+				if(acks[key]++) {
+					continue;
+				}
+				if(!queued.count(key) && !delivered.count(key)) {
+					if(lost < 10) {
+						cerr << "stress\tLost request '" << key << "'" << endl;
+					}
+					lost++;
+				}
+			}
+		}
+
+		for(auto &entry : delivered) {
+			size_t copies = entry.second + (queued.count(entry.first) ? 1 : 0);
+			auto ack = acks.find(entry.first);
+			size_t expected = std::max((size_t) 1, ack == acks.end() ? (size_t) 0 : ack->second);
+			if(copies > expected) {
+				redelivered += (copies - expected);
+			}
+		}
+
+		size_t requests = acks.size();
+
+		cout	<< "stress\t" << requests << " acknowledged request(s), "
+				<< delivered.size() << " delivered, "
+				<< queued.size() << " still queued, "
+				<< redelivered << " redelivered, "
+				<< lost << " lost" << endl;
+
+		int rc = 0;
+
+		if(lost) {
+			cerr << "stress\t" << lost << " acknowledged request(s) lost" << endl;
+			rc = 1;
+		}
+
+		if(delivered.empty()) {
+			cerr << "stress\tNothing was delivered" << endl;
+			rc = 1;
+		}
+
+		// At-least-once: the sink is written before the delete, so each sender can
+		// redeliver the request it was sending when its run was interrupted.
+		size_t bound = runs * atoi(option("STRESS_SENDERS","4"));
+		if(redelivered > bound) {
+			cerr << "stress\t" << redelivered << " redelivered request(s), expected at most " << bound << endl;
+			rc = 1;
+		}
+
+		return rc;
+
+	}
+
+	static int run(size_t runs) {
+
+		for(const char *name : { dbname, acked, sent }) {
+			unlink(name);
+			unlink((string{name} + "-wal").c_str());
+			unlink((string{name} + "-shm").c_str());
+			unlink((string{name} + "-journal").c_str());
+		}
+
+		std::random_device random;
+		std::uniform_int_distribution<unsigned int> lifetime{500,3000};
+
+		// Buffered requests are acknowledged before the insert, a SIGKILL loses them by
+		// design; with the buffer every run is stopped gracefully, so any loss is a failure.
+		bool kill9 = !atoi(option("STRESS_BUFFER","0"));
+
+		for(size_t run = 1; run <= runs; run++) {
+
+			pid_t pid = fork();
+			if(pid < 0) {
+				cerr << "stress\tCan't fork: " << strerror(errno) << endl;
+				return -1;
+			}
+
+			if(pid == 0) {
+				child(run);
+			}
+
+			this_thread::sleep_for(chrono::milliseconds(lifetime(random)));
+
+			if(kill9 && (run % 2)) {
+
+				kill(pid,SIGKILL);
+				waitpid(pid,NULL,0);
+				cout << "stress\tRun " << run << " killed" << endl;
+
+			} else {
+
+				// Even runs (all of them with the buffer): graceful shutdown, killed if it takes more than 5 seconds.
+				kill(pid,SIGTERM);
+
+				int status = 0;
+				auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+				while(waitpid(pid,&status,WNOHANG) == 0) {
+					if(chrono::steady_clock::now() > deadline) {
+						cerr << "stress\tRun " << run << " didn't stop in 5 seconds, killing it" << endl;
+						kill(pid,SIGKILL);
+						waitpid(pid,&status,0);
+						return 1;
+					}
+					this_thread::sleep_for(chrono::milliseconds(10));
+				}
+
+				cout << "stress\tRun " << run << " terminated" << endl;
+
+			}
+
+		}
+
+		return verify(runs);
+
+	}
+
+ }
+
+#endif // _WIN32
+
 //---[ Implement ]------------------------------------------------------------------------------------------
 
 int main(int argc, char **argv) {
 
+#ifndef _WIN32
+	// Crash test: testprogram --stress[=runs]
+	if(argc > 1 && !strncmp(argv[1],"--stress",8)) {
+		return Stress::run(argv[1][8] == '=' ? atoi(argv[1]+9) : 10);
+	}
+#endif // _WIN32
+
 	Logger::verbosity(9);
 	Logger::console(true);
 	Logger::redirect();